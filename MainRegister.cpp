@@ -40,27 +40,7 @@ extern "C" void add_analyzer_ctu_checker(register_checker_callback_t f,
   getCTUAnalysisName().insert(make_pair(name, desc));
 }
 
-#define gen_Register(name)                                                     \
-  static std::vector<plugin_callback> &getPlugin_##name##_Callbacks() {        \
-    static std::vector<plugin_callback> callbacks;                             \
-    return callbacks;                                                          \
-  }                                                                            \
-  extern "C" void add_plugin_##name##_checker(                                 \
-      plugin_callback f, string checkername, string desc) {                    \
-    getPlugin_##name##_Callbacks().push_back(f);                               \
-    getCheckersName().insert(make_pair(checkername, make_pair(desc, #name)));  \
-  }                                                                            \
-  void misra_##name##_register(MisraManager *mgr) {                            \
-    vector<plugin_callback> callbacks;                                         \
-    callbacks = getPlugin_##name##_Callbacks();                                \
-    for (auto it : callbacks) {                                                \
-      (*it)(mgr);                                                              \
-    }                                                                          \
-  }
-
-gen_Register(visitor) gen_Register(ctu_visitor)
-
-    void misra_analysis_register(clang::ento::CheckerRegistry &registry) {
+void misra_analysis_register(clang::ento::CheckerRegistry &registry) {
   auto callbacks = getAnalysisCallbacks();
   for (auto it : callbacks) {
     (*it)(registry);
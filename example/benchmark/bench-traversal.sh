@@ -0,0 +1,77 @@
+#!/usr/bin/env bash
+
+# Compare the fused traversal (-fused=true) with one traversal per checker
+# (-fused=false) on the same input.
+#   ./bench-traversal.sh [source file] [runs]
+
+SCRIPT_DIR=$( cd -- "$( dirname -- "${BASH_SOURCE[0]}" )" &> /dev/null && pwd )
+LLVM_BUILD=${LLVM_BUILD:-$SCRIPT_DIR/../../../../../../build}
+CLANG=$LLVM_BUILD/bin/clang
+MISRA_CHECKER=$LLVM_BUILD/lib/MisracppChecker.so
+
+SRC=${1:-$SCRIPT_DIR/stl-heavy.cpp}
+RUNS=${2:-5}
+
+if [ ! -f $CLANG ]; then
+    echo "clang not found, specified LLVM_BUILD for $0"
+    echo "expected clang path: $CLANG"
+    exit 1
+fi
+
+if [ ! -f $MISRA_CHECKER ]; then
+    echo "MisracppChecker.so not found, specified LLVM_BUILD for $0"
+    echo "expected MisracppChecker.so path: $MISRA_CHECKER"
+    exit 1
+fi
+
+WORK_DIR=$(mktemp -d)
+trap "rm -rf $WORK_DIR" EXIT
+
+plugin="-Xclang -plugin-arg-Misra-Checker -Xclang"
+
+# run_mode <fused> : print the average wall time in ms of $RUNS runs
+run_mode() {
+    cmd="$CLANG -fsyntax-only -Xclang -load -Xclang $MISRA_CHECKER"
+    cmd="$cmd -Xclang -plugin -Xclang Misra-Checker"
+    cmd="$cmd $plugin -config=$SCRIPT_DIR/config.json"
+    cmd="$cmd $plugin -astdir=$WORK_DIR"
+    cmd="$cmd $plugin -o=$WORK_DIR/report_$1.json"
+    cmd="$cmd $plugin -fused=$1"
+
+    total=0
+    for i in $(seq $RUNS)
+    do
+        start=$(date +%s%N)
+        $cmd $SRC > /dev/null 2>&1
+        end=$(date +%s%N)
+        total=$((total + (end - start) / 1000000))
+    done
+    echo $((total / RUNS))
+}
+
+separate=$(run_mode false)
+fused=$(run_mode true)
+
+echo "input: $SRC ($RUNS runs)"
+echo "one traversal per checker: ${separate} ms"
+echo "fused traversal:           ${fused} ms"
+
+# Both modes must report the same diagnostics, only the order may change.
+# The order also numbers the files, compare the paths instead of the indices.
+python3 - $WORK_DIR/report_false.json $WORK_DIR/report_true.json <<'PY'
+import json, sys
+
+def load(f):
+    report = json.load(open(f))
+    for d in report.get("diagnostics", []):
+        for p in d.get("path", []):
+            for loc in [p["location"]] + p.get("ranges", []):
+                loc["file"] = report["files"][loc["file"]]
+    return report
+
+diags = [sorted(json.dumps(d, sort_keys=True)
+                for d in load(f).get("diagnostics", []))
+         for f in sys.argv[1:]]
+if diags[0] != diags[1]:
+    print("warning: reports of the two modes differ")
+PY
@@ -0,0 +1,46 @@
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct Base {
+  virtual ~Base() {}
+};
+struct Left : virtual Base {};
+struct Right : virtual Base {};
+struct Diamond : Left, Right {};
+
+template <typename T> T accumulate(const std::vector<T> &v) {
+  T sum = T();
+  for (auto &e : v)
+    sum += e;
+  return sum;
+}
+
+int main() {
+  std::map<std::string, std::vector<int>> table;
+  std::unordered_map<int, std::set<std::string>> index;
+  std::ostringstream os;
+
+  for (int i = 0; i < 100; ++i) {
+    std::string key = std::to_string(i % 7);
+    table[key].push_back(i);
+    index[i % 3].insert(key);
+  }
+
+  for (auto &kv : table) {
+    std::sort(kv.second.begin(), kv.second.end(), std::greater<int>());
+    os << kv.first << ":" << accumulate(kv.second) << "\n";
+  }
+
+  std::unique_ptr<Base> d(new Diamond());
+  unsigned char c = static_cast<unsigned char>(index.size());
+  std::cout << os.str() << (unsigned int)(c + 1) << std::endl;
+  return 0;
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Compression.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+/* Content addressed store of the .ast files CTU imports from. An AST is named
+ * by the hash of its main file, of its content and of the parse options other
+ * than command line macros, the static and shared builds of a TU share one AST
+ * and every pass of a scan knows the name before the AST is written.
+ *
+ * With compression an AST is stored as "<name>.ast.z":
+ *   "MISRAASZ", size of the AST (64 bits, little endian), the zlib stream
+ * CTU can't load an AST from memory, on its first import it is inflated to
+ * "cache/<name>.ast" next to the store and mapped from there.
+ */
+namespace ASTStore {
+
+static const char Magic[8] = {'M', 'I', 'S', 'R', 'A', 'A', 'S', 'Z'};
+static const unsigned HeaderSize = 16;
+
+inline bool isCompressed(llvm::StringRef Path) { return Path.endswith(".z"); }
+
+inline bool writeAtomically(llvm::StringRef Path, llvm::StringRef Data) {
+  int FD;
+  llvm::SmallString<256> TmpPath;
+  if (llvm::sys::fs::createUniqueFile(Path + "-%%%%%%", FD, TmpPath))
+    return false;
+  {
+    llvm::raw_fd_ostream OS(FD, true);
+    OS << Data;
+    OS.close();
+    if (OS.has_error()) {
+      OS.clear_error();
+      llvm::sys::fs::remove(TmpPath);
+      return false;
+    }
+  }
+  // a TU built twice writes the same AST, the last rename wins
+  if (llvm::sys::fs::rename(TmpPath, Path)) {
+    llvm::sys::fs::remove(TmpPath);
+    return false;
+  }
+  return true;
+}
+
+// Buffers the AST and writes it compressed when the stream goes away, the
+// PCH container generator owns the stream
+class CompressedOutputStream : private llvm::SmallVector<char, 0>,
+                               public llvm::raw_svector_ostream {
+private:
+  std::string Path;
+
+  llvm::SmallVectorImpl<char> &getData() { return *this; }
+
+public:
+  explicit CompressedOutputStream(llvm::StringRef Path)
+      : llvm::raw_svector_ostream(getData()), Path(Path) {}
+
+  ~CompressedOutputStream() override {
+    // an unfinished AST is left out like createOutputFile does
+    if (getData().empty())
+      return;
+    llvm::SmallString<0> Compressed;
+    Compressed.append(Magic, Magic + sizeof(Magic));
+    char Size[8];
+    llvm::support::endian::write64le(Size, getData().size());
+    Compressed.append(Size, Size + sizeof(Size));
+    llvm::SmallVector<char, 0> Stream;
+    if (llvm::Error E = llvm::zlib::compress(
+            llvm::StringRef(getData().data(), getData().size()), Stream)) {
+      llvm::consumeError(std::move(E));
+      return;
+    }
+    Compressed.append(Stream.begin(), Stream.end());
+    writeAtomically(Path, Compressed);
+  }
+};
+
+// The path to load the AST stored at Path from, empty if it can't be inflated
+inline std::string getLoadablePath(llvm::StringRef Path) {
+  if (!isCompressed(Path))
+    return Path.str();
+
+  auto BufferOrErr = llvm::MemoryBuffer::getFile(Path, -1, false);
+  if (!BufferOrErr)
+    return std::string();
+  llvm::StringRef Data = (*BufferOrErr)->getBuffer();
+  if (Data.size() < HeaderSize ||
+      std::memcmp(Data.data(), Magic, sizeof(Magic)) != 0)
+    return std::string();
+  uint64_t Size = llvm::support::endian::read64le(Data.data() + 8);
+
+  // The name doesn't change when the AST is written again, the inflated copy
+  // is only reused if it is not older than the AST and has its size
+  llvm::SmallString<256> CachePath(llvm::sys::path::parent_path(Path));
+  llvm::sys::path::append(CachePath, "cache",
+                          llvm::sys::path::filename(Path.drop_back(2)));
+  llvm::sys::fs::file_status Stored, Cached;
+  if (!llvm::sys::fs::status(Path, Stored) &&
+      !llvm::sys::fs::status(CachePath, Cached) &&
+      Cached.getLastModificationTime() >= Stored.getLastModificationTime() &&
+      Cached.getSize() == Size)
+    return CachePath.str();
+
+  llvm::SmallVector<char, 0> AST;
+  if (llvm::Error E =
+          llvm::zlib::uncompress(Data.drop_front(HeaderSize), AST, Size)) {
+    llvm::consumeError(std::move(E));
+    return std::string();
+  }
+
+  llvm::sys::fs::create_directories(llvm::sys::path::parent_path(CachePath));
+  if (!writeAtomically(CachePath, llvm::StringRef(AST.data(), AST.size())))
+    return std::string();
+  return CachePath.str();
+}
+
+} // namespace ASTStore
@@ -0,0 +1,240 @@
+#pragma once
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* Binary CTU index: a hash table from the USR of a function definition to the
+ * AST file holding it. The file is mapped and looked up in place, its load
+ * time doesn't depend on the number of functions.
+ *
+ * All integers are little endian:
+ *   header   "MISRAIDX", version, #files, #buckets (a power of two),
+ *            #entries, size of the string pool, reserved      (32 bytes)
+ *   files    #files x {offset, length} of the AST path in the pool
+ *   buckets  #buckets + 1 x index of the first entry of the bucket
+ *   entries  #entries x {hash, offset, length of the USR, file, reserved}
+ *   strings  the pool
+ * The entries are sorted by bucket, bucket i holds the entries
+ * [buckets[i], buckets[i + 1]).
+ *
+ * misra-index-merge merges the index of every TU into the index of a target
+ * and still reads the former text format, one "<USR> <AST path>" per line.
+ */
+namespace CTUIndex {
+
+static const char Magic[8] = {'M', 'I', 'S', 'R', 'A', 'I', 'D', 'X'};
+static const uint32_t Version = 1;
+
+struct Header {
+  char Magic[8];
+  uint32_t Version;
+  uint32_t NumFiles;
+  uint32_t NumBuckets;
+  uint32_t NumEntries;
+  uint32_t StringsSize;
+  uint32_t Reserved;
+};
+
+struct Entry {
+  uint64_t Hash;
+  uint32_t Offset;
+  uint32_t Length;
+  uint32_t File;
+  uint32_t Reserved;
+};
+
+static_assert(sizeof(Header) == 32 && sizeof(Entry) == 24,
+              "the layout of the index file");
+
+// FNV-1a, misra-scan merges indexes in python when the tool is missing
+inline uint64_t hashUSR(llvm::StringRef USR) {
+  uint64_t Hash = 0xcbf29ce484222325ULL;
+  for (unsigned char C : USR) {
+    Hash ^= C;
+    Hash *= 0x100000001b3ULL;
+  }
+  return Hash;
+}
+
+inline bool isBinaryIndex(llvm::StringRef Buffer) {
+  return Buffer.size() >= sizeof(Header) &&
+         std::memcmp(Buffer.data(), Magic, sizeof(Magic)) == 0;
+}
+
+// USRs are added in order, the first definition of a USR wins
+class Builder {
+private:
+  std::vector<std::string> Files;
+  llvm::StringMap<uint32_t> FileIDs;
+  std::vector<std::pair<std::string, uint32_t>> Entries;
+  llvm::StringMap<char> Seen;
+
+public:
+  // False for a USR already in the index
+  bool add(llvm::StringRef USR, llvm::StringRef ASTFile) {
+    if (!Seen.insert({USR, 0}).second)
+      return false;
+    auto It = FileIDs.insert({ASTFile, static_cast<uint32_t>(Files.size())});
+    if (It.second)
+      Files.push_back(ASTFile.str());
+    Entries.emplace_back(USR.str(), It.first->second);
+    return true;
+  }
+
+  size_t size() const { return Entries.size(); }
+
+  void write(llvm::raw_ostream &OS) const {
+    auto write32 = [&OS](uint32_t Value) {
+      char Buf[4];
+      llvm::support::endian::write32le(Buf, Value);
+      OS.write(Buf, sizeof(Buf));
+    };
+    auto write64 = [&OS](uint64_t Value) {
+      char Buf[8];
+      llvm::support::endian::write64le(Buf, Value);
+      OS.write(Buf, sizeof(Buf));
+    };
+
+    uint32_t NumBuckets = 1;
+    while (NumBuckets < Entries.size())
+      NumBuckets <<= 1;
+
+    // Count sort the entries into their buckets, ties keep their order
+    std::vector<uint64_t> Hashes;
+    std::vector<uint32_t> Buckets(NumBuckets + 1, 0);
+    for (auto &E : Entries) {
+      Hashes.push_back(hashUSR(E.first));
+      ++Buckets[(Hashes.back() & (NumBuckets - 1)) + 1];
+    }
+    for (uint32_t i = 0; i < NumBuckets; ++i)
+      Buckets[i + 1] += Buckets[i];
+    std::vector<uint32_t> Order(Entries.size());
+    std::vector<uint32_t> Next(Buckets.begin(), Buckets.end() - 1);
+    for (uint32_t i = 0; i < Entries.size(); ++i)
+      Order[Next[Hashes[i] & (NumBuckets - 1)]++] = i;
+
+    std::string Strings;
+    std::vector<uint32_t> FileOffsets, USROffsets(Entries.size());
+    for (auto &File : Files) {
+      FileOffsets.push_back(Strings.size());
+      Strings += File;
+    }
+    for (uint32_t i = 0; i < Entries.size(); ++i) {
+      USROffsets[i] = Strings.size();
+      Strings += Entries[i].first;
+    }
+
+    OS.write(Magic, sizeof(Magic));
+    write32(Version);
+    write32(Files.size());
+    write32(NumBuckets);
+    write32(Entries.size());
+    write32(Strings.size());
+    write32(0);
+    for (uint32_t i = 0; i < Files.size(); ++i) {
+      write32(FileOffsets[i]);
+      write32(Files[i].size());
+    }
+    for (uint32_t Bucket : Buckets)
+      write32(Bucket);
+    for (uint32_t i : Order) {
+      write64(Hashes[i]);
+      write32(USROffsets[i]);
+      write32(Entries[i].first.size());
+      write32(Entries[i].second);
+      write32(0);
+    }
+    OS << Strings;
+  }
+};
+
+// A mapped binary index
+class Reader {
+private:
+  std::unique_ptr<llvm::MemoryBuffer> Buffer;
+  uint32_t NumFiles = 0, NumBuckets = 0, NumEntries = 0;
+  const char *Files = nullptr, *Buckets = nullptr, *Entries = nullptr,
+             *Strings = nullptr;
+  uint32_t StringsSize = 0;
+
+  static uint32_t read32(const char *P) {
+    return llvm::support::endian::read32le(P);
+  }
+
+  llvm::StringRef getString(const char *P) const {
+    uint32_t Offset = read32(P), Length = read32(P + 4);
+    if (uint64_t(Offset) + Length > StringsSize)
+      return llvm::StringRef();
+    return llvm::StringRef(Strings + Offset, Length);
+  }
+
+public:
+  // Null when the file can't be read or is no binary index of this version
+  static std::unique_ptr<Reader> open(llvm::StringRef Path) {
+    auto BufferOrErr = llvm::MemoryBuffer::getFile(Path, -1, false);
+    if (!BufferOrErr)
+      return nullptr;
+    std::unique_ptr<Reader> R(new Reader());
+    R->Buffer = std::move(*BufferOrErr);
+    llvm::StringRef Data = R->Buffer->getBuffer();
+    if (!isBinaryIndex(Data) || read32(Data.data() + 8) != Version)
+      return nullptr;
+
+    const char *P = Data.data() + 12;
+    R->NumFiles = read32(P);
+    R->NumBuckets = read32(P + 4);
+    R->NumEntries = read32(P + 8);
+    R->StringsSize = read32(P + 12);
+    uint64_t Size = sizeof(Header) + uint64_t(R->NumFiles) * 8 +
+                    (uint64_t(R->NumBuckets) + 1) * 4 +
+                    uint64_t(R->NumEntries) * sizeof(Entry) + R->StringsSize;
+    if (R->NumBuckets == 0 || (R->NumBuckets & (R->NumBuckets - 1)) ||
+        Size != Data.size())
+      return nullptr;
+    R->Files = Data.data() + sizeof(Header);
+    R->Buckets = R->Files + uint64_t(R->NumFiles) * 8;
+    R->Entries = R->Buckets + (uint64_t(R->NumBuckets) + 1) * 4;
+    R->Strings = R->Entries + uint64_t(R->NumEntries) * sizeof(Entry);
+    return R;
+  }
+
+  uint32_t size() const { return NumEntries; }
+
+  // The AST file defining USR, empty when it isn't in the index
+  llvm::StringRef lookup(llvm::StringRef USR) const {
+    uint64_t Hash = hashUSR(USR);
+    uint32_t Bucket = Hash & (NumBuckets - 1);
+    uint32_t Begin = read32(Buckets + Bucket * 4),
+             End = std::min(read32(Buckets + (Bucket + 1) * 4), NumEntries);
+    for (uint32_t i = Begin; i < End; ++i) {
+      const char *E = Entries + uint64_t(i) * sizeof(Entry);
+      if (llvm::support::endian::read64le(E) != Hash ||
+          getString(E + 8) != USR)
+        continue;
+      uint32_t File = read32(E + 16);
+      return File < NumFiles ? getString(Files + File * 8) : llvm::StringRef();
+    }
+    return llvm::StringRef();
+  }
+
+  // Every entry in the order of the file, for merging
+  template <typename Fn> void forEach(Fn F) const {
+    for (uint32_t i = 0; i < NumEntries; ++i) {
+      const char *E = Entries + uint64_t(i) * sizeof(Entry);
+      uint32_t File = read32(E + 16);
+      if (File < NumFiles)
+        F(getString(E + 8), getString(Files + File * 8));
+    }
+  }
+};
+
+} // namespace CTUIndex
@@ -0,0 +1,17 @@
+#pragma once
+#include "clang/AST/Decl.h"
+
+/* Definitions of functions of other TUs for the CTU checkers. Nothing is
+ * imported up front, a checker asks for the body of a callee when it needs
+ * it and only those definitions are loaded and imported into its AST.
+ */
+class CrossTUImporter {
+public:
+  virtual ~CrossTUImporter() {}
+
+  // The definition of FD imported from the TU defining it, nullptr if there
+  // is none. Results are cached for the TU, a missing definition is only
+  // looked up once.
+  virtual const clang::FunctionDecl *
+  getDefinition(const clang::FunctionDecl *FD) = 0;
+};
@@ -1,4 +1,7 @@
 #pragma once
+#include "ASTStore.hpp"
+#include "CTUIndex.hpp"
+#include "CrossTUImporter.hpp"
 #include "DebugInfo.h"
 #include "Reporter.hpp"
 #include "helper/SrcHelper.h"
@@ -12,6 +15,7 @@
 #include "clang/CrossTU/CrossTranslationUnit.h"
 #include "clang/Driver/Options.h"
 #include "clang/Frontend/ASTConsumers.h"
+#include "clang/Frontend/ASTUnit.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendActions.h"
 #include "clang/Frontend/FrontendPluginRegistry.h"
@@ -31,13 +35,23 @@
 
 #include <nlohmann/json.hpp>
 
+#include <chrono>
+#include <memory>
+
 struct Config {
   std::string name;
   std::vector<std::string> checkers;
   std::string astdir;
+  std::string astfile;
   std::string indexfile;
   std::string filename;
   bool ctu;
+  bool fused;
+  unsigned int jobs;
+  bool stream;
+  bool quiet;
+  bool filter;
+  std::vector<std::string> projectroots;
 };
 
 class Misradebug : public PragmaHandler {
@@ -56,13 +70,30 @@ public:
   DebugLoc getDebugInfo() { return loc; }
 };
 
+// When the .ast of the TU is written, -emit-ast=true|false|only
+enum class EmitAST {
+  // only if CTU checkers are enabled
+  Auto,
+  Always,
+  Never,
+  // nothing but the .ast, misra-scan asks for the ASTs CTU imports from
+  Only
+};
+
 class MisraPluginAction : public PluginASTAction {
-  MisraManager *mgr = new MisraManager();
-  MisraManager *ctu_mgr = new MisraManager();
+  MisraManager *mgr =
+      new MisraManager({"visitor", "local_visitor", "ast_matcher"});
+  MisraManager *ctu_mgr = new MisraManager({"ctu_visitor"});
   Config config;
   MisraReport::MisraBugReport *MBR = new MisraReport::MisraBugReport();
   std::string filename;
   std::string reportdir;
+  std::string claimdir;
+  std::string sharddir;
+  std::string aststore;
+  bool compressast = false;
+  MisraReport::ReportFormat reportformat = MisraReport::ReportFormat::JSON;
+  EmitAST emitast = EmitAST::Auto;
   bool list;
   unsigned int num_analysis = 0;
 
@@ -75,7 +106,7 @@ protected:
   void EndSourceFileAction() override;
 };
 
-class MisraASTConsumer : public ASTConsumer {
+class MisraASTConsumer : public ASTConsumer, public CrossTUImporter {
 private:
   MisraManager &mgr;
   CompilerInstance *CI;
@@ -83,7 +114,26 @@ private:
   Config config;
   MisraReport::MisraBugReport *mbr;
   std::vector<std::string> ValidName;
+  std::vector<Misrabase *> StreamCheckers;
+  std::unique_ptr<MisraTraversal> Stream;
+
+  // AST files loaded through a binary index, with their function definitions
+  // by lookup name. They outlive the importers of CTU.
+  struct ExternalAST {
+    std::unique_ptr<ASTUnit> Unit;
+    llvm::StringMap<const FunctionDecl *> Definitions;
+    bool Failed = false;
+  };
+  std::unique_ptr<CTUIndex::Reader> Index;
+  bool IndexOpened = false;
+  llvm::StringMap<ExternalAST> ExternalASTs;
   cross_tu::CrossTranslationUnitContext CTU;
+  // Definitions asked for by the checkers by canonical decl, nullptr if the
+  // import failed
+  llvm::DenseMap<const FunctionDecl *, const FunctionDecl *> Imported;
+
+  llvm::Expected<const FunctionDecl *>
+  getCrossTUDefinition(const FunctionDecl *FD);
 
 public:
   explicit MisraASTConsumer(CompilerInstance *CI, MisraManager &MM,
@@ -93,6 +143,8 @@ public:
   virtual void Initialize(ASTContext &Context);
   virtual bool HandleTopLevelDecl(DeclGroupRef DG);
   virtual void HandleTranslationUnit(ASTContext &Context);
+
+  const FunctionDecl *getDefinition(const FunctionDecl *FD) override;
 };
 
 class IndexConsumer : public ASTConsumer {
@@ -100,17 +152,48 @@ private:
   CompilerInstance *CI;
   Misradebug *handler;
   Config config;
-  fstream fp;
+  MisraReport::MisraBugReport *mbr;
+  CTUIndex::Builder Index;
+  // Write the functions the TU calls but doesn't define, misra-scan only
+  // runs the CTU checkers on a TU which has some defined in another one
+  bool WriteExterns;
 
 public:
-  explicit IndexConsumer(CompilerInstance *CI, Config config)
-      : CI(CI), config(config) {}
+  explicit IndexConsumer(CompilerInstance *CI, Config config,
+                         MisraReport::MisraBugReport *MBR, bool WriteExterns)
+      : CI(CI), config(config), mbr(MBR), WriteExterns(WriteExterns) {}
 
   virtual void Initialize(ASTContext &Context);
   virtual bool HandleTopLevelDecl(DeclGroupRef DG);
   virtual void HandleTranslationUnit(ASTContext &Context);
 };
 
+// Put one before and one after a run of consumers in the MultiplexConsumer to
+// time their HandleTranslationUnit
+class StatMarker : public ASTConsumer {
+private:
+  MisraReport::MisraBugReport *mbr;
+  std::string name;
+  std::shared_ptr<std::chrono::steady_clock::time_point> start;
+  bool stop;
+
+public:
+  StatMarker(MisraReport::MisraBugReport *MBR, std::string name,
+             std::shared_ptr<std::chrono::steady_clock::time_point> start,
+             bool stop)
+      : mbr(MBR), name(name), start(start), stop(stop) {}
+
+  void HandleTranslationUnit(ASTContext &Context) override {
+    auto now = std::chrono::steady_clock::now();
+    if (!stop) {
+      *start = now;
+      return;
+    }
+    std::chrono::duration<double> elapsed = now - *start;
+    mbr->addStat(name, elapsed.count());
+  }
+};
+
 class MisraDiagnosticConsumer : public ento::PathDiagnosticConsumer {
 private:
   MisraReport::MisraBugReport &report;
@@ -121,8 +204,8 @@ public:
                             FilesMade *filesMade) override {
     std::cout << "Create a MisraBugReport\n";
     for (const ento::PathDiagnostic *PD : Diags) {
-      MisraReport::Diag *D = new MisraReport::Diag();
-      D->setinfo(PD->getShortDescription().str(), PD->getCategory().str(),
+      MisraReport::Diag D;
+      D.setinfo(PD->getShortDescription().str(), PD->getCategory().str(),
                  PD->getBugType().str(), PD->getCheckName().str());
 
       for (auto it : PD->path.flatten(true)) {
@@ -138,9 +221,9 @@ public:
                                       it->getString().str());
         // ReportHelper::CreateIssue(sm, range[0].getBegin(),
         // SourceRange{begin,end});
-        D->path.push_back(i);
+        D.path.push_back(std::move(i));
       }
-      report.AddDiag(*D);
+      report.AddDiag(std::move(D));
       std::cout << "\n";
     }
   }
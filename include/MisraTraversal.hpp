@@ -0,0 +1,469 @@
+#pragma once
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+
+#include "Reporter.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+using namespace clang;
+
+/* Fused traversal
+ *
+ * Every visitor checker used to run its own RecursiveASTVisitor over the whole
+ * translation unit, so N enabled checkers meant N full AST walks. A
+ * MisraTraversal walks the TU once and, at every node, calls the WalkUpFrom*
+ * chain of each joined checker. The checker sees exactly the Visit* calls it
+ * would have seen in its own traversal, in the same order.
+ *
+ * Only checkers that leave the traversal itself untouched can join: no
+ * Traverse or dataTraverse override, default shouldVisit policies and no
+ * attribute visitors. FusedTraits<T>::value decides that at compile time, the
+ * other checkers keep running their own traversal.
+ *
+ * A checker only subscribes to the node kinds whose WalkUpFrom* chain reaches
+ * one of its Visit* (or WalkUpFrom*) overrides, e.g. Rule_3_9_3 gets CastExpr
+ * and its subclasses and nothing else. The subscriptions are worked out at
+ * compile time by Subscribes<T, Node> and gathered into per-kind dispatch
+ * tables on join, so a node nobody subscribed to costs one table lookup.
+ *
+ * A pruning traversal doesn't descend into file level decls (including whole
+ * namespaces) declared in system headers or outside the project roots, see
+ * SourceFilter. Checkers opt back in with MisraVisitor::shouldVisitSystemHeaders
+ * and then share a traversal which doesn't prune.
+ */
+
+#define MISRA_OVERRIDES(NAME)                                                  \
+  (!std::is_same<decltype(&VisitorClass::NAME), decltype(&Base::NAME)>::value)
+
+#define MISRA_BINOP_LIST()                                                     \
+  OPERATOR(PtrMemD) OPERATOR(PtrMemI) OPERATOR(Mul) OPERATOR(Div)              \
+  OPERATOR(Rem) OPERATOR(Add) OPERATOR(Sub) OPERATOR(Shl) OPERATOR(Shr)        \
+  OPERATOR(LT) OPERATOR(GT) OPERATOR(LE) OPERATOR(GE) OPERATOR(EQ)             \
+  OPERATOR(NE) OPERATOR(Cmp) OPERATOR(And) OPERATOR(Xor) OPERATOR(Or)          \
+  OPERATOR(LAnd) OPERATOR(LOr) OPERATOR(Assign) OPERATOR(Comma)
+
+#define MISRA_CAO_LIST()                                                       \
+  OPERATOR(Mul) OPERATOR(Div) OPERATOR(Rem) OPERATOR(Add) OPERATOR(Sub)        \
+  OPERATOR(Shl) OPERATOR(Shr) OPERATOR(And) OPERATOR(Or) OPERATOR(Xor)
+
+#define MISRA_UNARYOP_LIST()                                                   \
+  OPERATOR(PostInc) OPERATOR(PostDec) OPERATOR(PreInc) OPERATOR(PreDec)        \
+  OPERATOR(AddrOf) OPERATOR(Deref) OPERATOR(Plus) OPERATOR(Minus)              \
+  OPERATOR(Not) OPERATOR(LNot) OPERATOR(Real) OPERATOR(Imag)                   \
+  OPERATOR(Extension) OPERATOR(Coawait)
+
+template <typename VisitorClass> struct FusedTraits {
+  using Base = RecursiveASTVisitor<VisitorClass>;
+
+  static constexpr bool Policy =
+      !MISRA_OVERRIDES(shouldVisitTemplateInstantiations) &&
+      !MISRA_OVERRIDES(shouldWalkTypesOfTypeLocs) &&
+      !MISRA_OVERRIDES(shouldVisitImplicitCode) &&
+      !MISRA_OVERRIDES(shouldTraversePostOrder);
+
+  static constexpr bool Generic =
+      !MISRA_OVERRIDES(TraverseDecl) && !MISRA_OVERRIDES(TraverseStmt) &&
+      !MISRA_OVERRIDES(TraverseType) && !MISRA_OVERRIDES(TraverseTypeLoc) &&
+      !MISRA_OVERRIDES(TraverseAttr) &&
+      !MISRA_OVERRIDES(TraverseNestedNameSpecifier) &&
+      !MISRA_OVERRIDES(TraverseNestedNameSpecifierLoc) &&
+      !MISRA_OVERRIDES(TraverseDeclarationNameInfo) &&
+      !MISRA_OVERRIDES(TraverseTemplateName) &&
+      !MISRA_OVERRIDES(TraverseTemplateArgument) &&
+      !MISRA_OVERRIDES(TraverseTemplateArgumentLoc) &&
+      !MISRA_OVERRIDES(TraverseTemplateArguments) &&
+      !MISRA_OVERRIDES(TraverseCXXBaseSpecifier) &&
+      !MISRA_OVERRIDES(TraverseConstructorInitializer) &&
+      !MISRA_OVERRIDES(TraverseLambdaCapture) &&
+      !MISRA_OVERRIDES(dataTraverseStmtPre) &&
+      !MISRA_OVERRIDES(dataTraverseStmtPost);
+
+  static constexpr bool Stmts = true
+#define ABSTRACT_STMT(STMT)
+#define STMT(CLASS, PARENT) &&!MISRA_OVERRIDES(Traverse##CLASS)
+#include "clang/AST/StmtNodes.inc"
+#define OPERATOR(NAME) &&!MISRA_OVERRIDES(TraverseBin##NAME)
+      MISRA_BINOP_LIST()
+#undef OPERATOR
+#define OPERATOR(NAME) &&!MISRA_OVERRIDES(TraverseBin##NAME##Assign)
+      MISRA_CAO_LIST()
+#undef OPERATOR
+#define OPERATOR(NAME) &&!MISRA_OVERRIDES(TraverseUnary##NAME)
+      MISRA_UNARYOP_LIST()
+#undef OPERATOR
+      ;
+
+  static constexpr bool Decls = true
+#define ABSTRACT_DECL(DECL)
+#define DECL(CLASS, BASE) &&!MISRA_OVERRIDES(Traverse##CLASS##Decl)
+#include "clang/AST/DeclNodes.inc"
+      ;
+
+  static constexpr bool Types = true
+#define ABSTRACT_TYPE(CLASS, BASE)
+#define TYPE(CLASS, BASE) &&!MISRA_OVERRIDES(Traverse##CLASS##Type)
+#include "clang/AST/TypeNodes.def"
+      ;
+
+  static constexpr bool TypeLocs = true
+#define ABSTRACT_TYPELOC(CLASS, BASE)
+#define TYPELOC(CLASS, BASE) &&!MISRA_OVERRIDES(Traverse##CLASS##TypeLoc)
+#include "clang/AST/TypeLocNodes.def"
+      ;
+
+  static constexpr bool Attrs = !MISRA_OVERRIDES(VisitAttr)
+#define ATTR(NAME) &&!MISRA_OVERRIDES(Visit##NAME##Attr)
+#include "clang/Basic/AttrList.inc"
+#undef ATTR
+      ;
+
+  static constexpr bool value =
+      Policy && Generic && Stmts && Decls && Types && TypeLocs && Attrs;
+};
+
+// Subscribes<VisitorClass, Node>::value is true if visiting a Node calls a
+// Visit* or WalkUpFrom* which VisitorClass overrides, following the same
+// parent chain as RecursiveASTVisitor::WalkUpFrom*
+template <typename VisitorClass, typename Node> struct Subscribes;
+
+#define MISRA_SUBSCRIBES(NODE, PARENT)                                         \
+  template <typename VisitorClass> struct Subscribes<VisitorClass, NODE> {     \
+    using Base = RecursiveASTVisitor<VisitorClass>;                            \
+    static constexpr bool value = MISRA_OVERRIDES(Visit##NODE) ||              \
+                                  MISRA_OVERRIDES(WalkUpFrom##NODE) ||         \
+                                  Subscribes<VisitorClass, PARENT>::value;     \
+  };
+
+#define MISRA_SUBSCRIBES_ROOT(NODE)                                            \
+  template <typename VisitorClass> struct Subscribes<VisitorClass, NODE> {     \
+    using Base = RecursiveASTVisitor<VisitorClass>;                            \
+    static constexpr bool value =                                              \
+        MISRA_OVERRIDES(Visit##NODE) || MISRA_OVERRIDES(WalkUpFrom##NODE);     \
+  };
+
+MISRA_SUBSCRIBES_ROOT(Stmt)
+#define STMT(CLASS, PARENT) MISRA_SUBSCRIBES(CLASS, PARENT)
+#include "clang/AST/StmtNodes.inc"
+
+MISRA_SUBSCRIBES_ROOT(Decl)
+#define DECL(CLASS, BASE) MISRA_SUBSCRIBES(CLASS##Decl, BASE)
+#include "clang/AST/DeclNodes.inc"
+
+MISRA_SUBSCRIBES_ROOT(Type)
+#define TYPE(CLASS, BASE) MISRA_SUBSCRIBES(CLASS##Type, BASE)
+#include "clang/AST/TypeNodes.def"
+
+MISRA_SUBSCRIBES_ROOT(TypeLoc)
+#define TYPELOC(CLASS, BASE) MISRA_SUBSCRIBES(CLASS##TypeLoc, BASE)
+#include "clang/AST/TypeLocNodes.def"
+
+#undef MISRA_SUBSCRIBES
+#undef MISRA_SUBSCRIBES_ROOT
+
+// Type-erased view of a checker joined to a MisraTraversal
+class FusedVisitor {
+public:
+  virtual ~FusedVisitor() {}
+
+  virtual void handlePre() = 0;
+  virtual void handlePost() = 0;
+
+  virtual bool visitDecl(Decl *D) = 0;
+  virtual bool visitStmt(Stmt *S) = 0;
+  virtual bool visitType(Type *T) = 0;
+  virtual bool visitTypeLoc(TypeLoc TL) = 0;
+
+  // A Visit* returned false, the checker asked to stop its traversal
+  bool aborted = false;
+
+  // Check name and number of nodes dispatched to the checker
+  std::string name;
+  uint64_t visits = 0;
+};
+
+// Dispatch a node to the most derived WalkUpFrom* of the checker, the same way
+// RecursiveASTVisitor::Traverse* does it
+template <typename VisitorClass> class FusedVisitorAdaptor : public FusedVisitor {
+private:
+  VisitorClass *V;
+
+public:
+  explicit FusedVisitorAdaptor(VisitorClass *V) : V(V) {}
+
+  void handlePre() override { V->handlePre(); }
+  void handlePost() override { V->handlePost(); }
+
+  bool visitDecl(Decl *D) override {
+    switch (D->getKind()) {
+#define ABSTRACT_DECL(DECL)
+#define DECL(CLASS, BASE)                                                      \
+  case Decl::CLASS:                                                            \
+    return V->WalkUpFrom##CLASS##Decl(static_cast<CLASS##Decl *>(D));
+#include "clang/AST/DeclNodes.inc"
+    default:
+      return true;
+    }
+  }
+
+  bool visitStmt(Stmt *S) override {
+    if (auto *BinOp = dyn_cast<BinaryOperator>(S)) {
+      switch (BinOp->getOpcode()) {
+#define OPERATOR(NAME)                                                         \
+  case BO_##NAME:                                                              \
+    return V->WalkUpFromBin##NAME(BinOp);
+        MISRA_BINOP_LIST()
+#undef OPERATOR
+#define OPERATOR(NAME)                                                         \
+  case BO_##NAME##Assign:                                                      \
+    return V->WalkUpFromBin##NAME##Assign(cast<CompoundAssignOperator>(BinOp));
+        MISRA_CAO_LIST()
+#undef OPERATOR
+      default:
+        break;
+      }
+    } else if (auto *UnOp = dyn_cast<UnaryOperator>(S)) {
+      switch (UnOp->getOpcode()) {
+#define OPERATOR(NAME)                                                         \
+  case UO_##NAME:                                                              \
+    return V->WalkUpFromUnary##NAME(UnOp);
+        MISRA_UNARYOP_LIST()
+#undef OPERATOR
+      default:
+        break;
+      }
+    }
+
+    switch (S->getStmtClass()) {
+#define ABSTRACT_STMT(STMT)
+#define STMT(CLASS, PARENT)                                                    \
+  case Stmt::CLASS##Class:                                                     \
+    return V->WalkUpFrom##CLASS(static_cast<CLASS *>(S));
+#include "clang/AST/StmtNodes.inc"
+    default:
+      return true;
+    }
+  }
+
+  bool visitType(Type *T) override {
+    switch (T->getTypeClass()) {
+#define ABSTRACT_TYPE(CLASS, BASE)
+#define TYPE(CLASS, BASE)                                                      \
+  case Type::CLASS:                                                            \
+    return V->WalkUpFrom##CLASS##Type(static_cast<CLASS##Type *>(T));
+#include "clang/AST/TypeNodes.def"
+    default:
+      return true;
+    }
+  }
+
+  bool visitTypeLoc(TypeLoc TL) override {
+    switch (TL.getTypeLocClass()) {
+#define ABSTRACT_TYPELOC(CLASS, BASE)
+#define TYPELOC(CLASS, BASE)                                                   \
+  case TypeLoc::CLASS:                                                         \
+    return V->WalkUpFrom##CLASS##TypeLoc(TL.castAs<CLASS##TypeLoc>());
+#include "clang/AST/TypeLocNodes.def"
+    default:
+      return true;
+    }
+  }
+};
+
+// Tells whether a file level decl belongs to the code under check. Decls in
+// system headers are excluded, and so are the ones outside all project roots
+// when any is given. The main file is always checked.
+class SourceFilter {
+private:
+  const SourceManager &SM;
+  std::vector<std::string> Roots;
+  llvm::DenseMap<FileID, bool> Excluded;
+
+  bool isExcludedFile(FileID FID, SourceLocation Loc);
+
+public:
+  SourceFilter(const SourceManager &SM,
+               const std::vector<std::string> &ProjectRoots);
+
+  bool isExcluded(const Decl *D);
+  bool isExcluded(SourceLocation Loc);
+};
+
+// Stmts on the path from the top level decl to the node being visited. A
+// nullptr entry stands for a decl in between, where the parent map would hand
+// out a decl instead of a stmt.
+class AncestorStack {
+private:
+  SmallVector<const Stmt *, 32> Stack;
+
+public:
+  void push(const Stmt *S) { Stack.push_back(S); }
+  void pop() { Stack.pop_back(); }
+  size_t size() const { return Stack.size(); }
+  void truncate(size_t N) { Stack.resize(N); }
+
+  // Parent stmt of S, nullptr if S is the root stmt of a decl. Found is false
+  // if S is not on the path. The search starts from the top, so the parent of
+  // the node being visited costs one step.
+  const Stmt *getParent(const Stmt *S, bool &Found) const {
+    for (size_t I = Stack.size(); I > 0; --I) {
+      if (Stack[I - 1] == S) {
+        Found = true;
+        return I > 1 ? Stack[I - 2] : nullptr;
+      }
+    }
+    Found = false;
+    return nullptr;
+  }
+};
+
+// The single RecursiveASTVisitor which drives all joined checkers
+class MisraTraversal : public RecursiveASTVisitor<MisraTraversal> {
+private:
+  typedef std::vector<FusedVisitor *> Subscribers;
+
+  ASTContext &Context;
+  std::vector<std::unique_ptr<FusedVisitor>> Visitors;
+  unsigned int Live = 0;
+  std::unique_ptr<SourceFilter> Filter;
+  AncestorStack Ancestors;
+
+  // Dispatch tables indexed by node kind, operators by opcode
+  Subscribers StmtTable[Stmt::lastStmtConstant + 1];
+  Subscribers BinOpTable[BO_Comma + 1];
+  Subscribers UnOpTable[UO_Coawait + 1];
+  Subscribers DeclTable[Decl::lastDecl + 1];
+  Subscribers TypeTable[Type::TypeLast + 1];
+  Subscribers TypeLocTable[TypeLoc::Qualified + 1];
+
+  template <typename Fn> bool dispatch(Subscribers &Subs, Fn F) {
+    for (auto *FV : Subs) {
+      if (FV->aborted)
+        continue;
+      ++FV->visits;
+      if (!F(*FV)) {
+        FV->aborted = true;
+        --Live;
+      }
+    }
+    // Stop the walk once every checker has given up
+    return Live > 0;
+  }
+
+  template <typename VisitorClass> void subscribe(FusedVisitor *FV) {
+    using Base = RecursiveASTVisitor<VisitorClass>;
+
+#define ABSTRACT_STMT(STMT)
+#define STMT(CLASS, PARENT)                                                    \
+  if (Subscribes<VisitorClass, CLASS>::value)                                  \
+    StmtTable[Stmt::CLASS##Class].push_back(FV);
+#include "clang/AST/StmtNodes.inc"
+
+#define OPERATOR(NAME)                                                         \
+  if (MISRA_OVERRIDES(VisitBin##NAME) || MISRA_OVERRIDES(WalkUpFromBin##NAME) || \
+      Subscribes<VisitorClass, BinaryOperator>::value)                         \
+    BinOpTable[BO_##NAME].push_back(FV);
+    MISRA_BINOP_LIST()
+#undef OPERATOR
+#define OPERATOR(NAME)                                                         \
+  if (MISRA_OVERRIDES(VisitBin##NAME##Assign) ||                               \
+      MISRA_OVERRIDES(WalkUpFromBin##NAME##Assign) ||                          \
+      Subscribes<VisitorClass, CompoundAssignOperator>::value)                 \
+    BinOpTable[BO_##NAME##Assign].push_back(FV);
+    MISRA_CAO_LIST()
+#undef OPERATOR
+#define OPERATOR(NAME)                                                         \
+  if (MISRA_OVERRIDES(VisitUnary##NAME) ||                                     \
+      MISRA_OVERRIDES(WalkUpFromUnary##NAME) ||                                \
+      Subscribes<VisitorClass, UnaryOperator>::value)                          \
+    UnOpTable[UO_##NAME].push_back(FV);
+    MISRA_UNARYOP_LIST()
+#undef OPERATOR
+
+#define ABSTRACT_DECL(DECL)
+#define DECL(CLASS, BASE)                                                      \
+  if (Subscribes<VisitorClass, CLASS##Decl>::value)                            \
+    DeclTable[Decl::CLASS].push_back(FV);
+#include "clang/AST/DeclNodes.inc"
+
+#define ABSTRACT_TYPE(CLASS, BASE)
+#define TYPE(CLASS, BASE)                                                      \
+  if (Subscribes<VisitorClass, CLASS##Type>::value)                            \
+    TypeTable[Type::CLASS].push_back(FV);
+#include "clang/AST/TypeNodes.def"
+
+#define ABSTRACT_TYPELOC(CLASS, BASE)
+#define TYPELOC(CLASS, BASE)                                                   \
+  if (Subscribes<VisitorClass, CLASS##TypeLoc>::value)                         \
+    TypeLocTable[TypeLoc::CLASS].push_back(FV);
+#include "clang/AST/TypeLocNodes.def"
+  }
+
+public:
+  explicit MisraTraversal(ASTContext &Context) : Context(Context) {}
+
+  // Return false if VisitorClass customizes its traversal and must run alone
+  template <typename VisitorClass>
+  bool join(VisitorClass *V, const std::string &Name) {
+    if (!FusedTraits<VisitorClass>::value)
+      return false;
+    Visitors.push_back(llvm::make_unique<FusedVisitorAdaptor<VisitorClass>>(V));
+    Visitors.back()->name = Name;
+    subscribe<VisitorClass>(Visitors.back().get());
+    ++Live;
+    return true;
+  }
+
+  bool empty() const { return Visitors.empty(); }
+  size_t size() const { return Visitors.size(); }
+
+  // Report the nodes each joined checker was handed, the wall time of the
+  // walk is shared and reported by the caller
+  void addStats(MisraReport::MisraBugReport &MBR) const;
+
+  // Skip file level decls outside the checked code from now on
+  void prune(const std::vector<std::string> &ProjectRoots) {
+    Filter = llvm::make_unique<SourceFilter>(Context.getSourceManager(),
+                                             ProjectRoots);
+  }
+
+  // Joined checkers look up the parents of the node they visit here instead of
+  // in the ASTContext parent map
+  const AncestorStack &getAncestors() const { return Ancestors; }
+
+  bool TraverseDecl(Decl *D);
+  bool dataTraverseStmtPre(Stmt *S) {
+    Ancestors.push(S);
+    return true;
+  }
+  bool dataTraverseStmtPost(Stmt *S) {
+    Ancestors.pop();
+    return true;
+  }
+
+  // Walk the whole TU
+  void run();
+
+  // Walk the TU one top level decl at a time, as the parser hands them out
+  void begin();
+  void traverse(Decl *D);
+  void end();
+
+  bool VisitDecl(Decl *D);
+  bool VisitStmt(Stmt *S);
+  bool VisitType(Type *T);
+  bool VisitTypeLoc(TypeLoc TL);
+};
+
+#undef MISRA_OVERRIDES
+#undef MISRA_BINOP_LIST
+#undef MISRA_CAO_LIST
+#undef MISRA_UNARYOP_LIST
@@ -2,6 +2,7 @@
 
 #include "clang/AST/ASTContext.h"
 #include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/ASTMatchers/ASTMatchFinder.h"
 
 // TODO REMOVE Static Analyzer Header
 #include "clang/StaticAnalyzer/Core/BugReporter/BugType.h"
@@ -14,14 +15,20 @@
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendActions.h"
 
+#include "CrossTUImporter.hpp"
 #include "DebugInfo.h"
+#include "MisraTraversal.hpp"
 #include "Reporter.hpp"
+#include "TimedPPCallbacks.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <utility>
+#include <vector>
 
 using namespace clang;
 // TODO REMOVE Static Analyzer Header
@@ -32,16 +39,24 @@ template <typename T> using is_PPCallbacks = std::is_base_of<PPCallbacks, T>;
 template <typename T>
 using is_visitor = std::is_base_of<RecursiveASTVisitor<T>, T>;
 
+template <typename T>
+using is_matcher =
+    std::is_base_of<ast_matchers::MatchFinder::MatchCallback, T>;
+
 typedef struct {
 } FullVisitor;
 
 template <typename T>
 using WhatKind = typename std::conditional<
-    is_PPCallbacks<T>::value && is_visitor<T>::value, FullVisitor,
+    is_matcher<T>::value, ast_matchers::MatchFinder::MatchCallback,
     typename std::conditional<
-        is_PPCallbacks<T>::value, PPCallbacks,
-        typename std::conditional<is_visitor<T>::value, RecursiveASTVisitor<T>,
-                                  std::false_type>::type>::type>::type;
+        is_PPCallbacks<T>::value && is_visitor<T>::value, FullVisitor,
+        typename std::conditional<
+            is_PPCallbacks<T>::value, PPCallbacks,
+            typename std::conditional<is_visitor<T>::value,
+                                      RecursiveASTVisitor<T>,
+                                      std::false_type>::type>::type>::type>::
+    type;
 
 // clang plugin register
 class Misrabase {
@@ -50,12 +65,36 @@ protected:
   string describe;
 
   Preprocessor *PP;
+  // Set by Init of the checkers with PPCallbacks, their hooks are timed
+  MisraReport::MisraBugReport *MBR = nullptr;
+
+  void addTimedPPCallbacks(CompilerInstance &CI,
+                           std::unique_ptr<PPCallbacks> Callbacks) {
+    CI.getPreprocessor().addPPCallbacks(llvm::make_unique<TimedPPCallbacks>(
+        std::move(Callbacks), *MBR, checkername));
+  }
 
 public:
+  virtual ~Misrabase() {}
   virtual void runChecker(ASTContext &Context) = 0;
   virtual void Init(ASTContext &Context, MisraReport::MisraBugReport &mbr) = 0;
   virtual void regPPCallbacks(CompilerInstance &CI) {}
   virtual void setDebugLoc(DebugLoc debug) {}
+  // Where the checker gets the definitions of other TUs, nullptr without CTU
+  virtual void setCrossTU(CrossTUImporter *Importer) {}
+  // Hand the checker to a shared traversal instead of runChecker, return false
+  // if it has to walk the AST by itself
+  virtual bool joinTraversal(MisraTraversal &Traversal) { return false; }
+  // Add the matchers of the checker to a shared MatchFinder instead of
+  // runChecker, return false if the checker is not matcher based
+  virtual bool joinMatchFinder(ast_matchers::MatchFinder &Finder) {
+    return false;
+  }
+  // True if the checker only looks inside the top level decl being visited
+  virtual bool isDeclLocal() { return false; }
+  // True if the checker wants decls from system headers and outside the
+  // project roots too
+  virtual bool visitSystemHeaders() { return true; }
 
   void setCheckerInfo(string name, string desc) {
     checkername = name;
@@ -90,12 +129,13 @@ public:
     Visitor = std::move(
         std::unique_ptr<VisitorClass>(new VisitorClass(&Context, mbr)));
     Visitor->Init();
+    MBR = &mbr;
   }
   void runChecker(ASTContext &Context) override {}
 
   void regPPCallbacks(CompilerInstance &CI) override {
     Visitor->setPreprocessor(&CI.getPreprocessor());
-    CI.getPreprocessor().addPPCallbacks(std::move(Visitor));
+    addTimedPPCallbacks(CI, std::move(Visitor));
   }
 };
 
@@ -112,6 +152,7 @@ public:
         std::unique_ptr<VisitorClass>(new VisitorClass(&Context, mbr)));
     Visitor->Init();
     V = Visitor.get();
+    MBR = &mbr;
   }
   void runChecker(ASTContext &Context) override {
     V->handlePre();
@@ -119,11 +160,24 @@ public:
     V->handlePost();
   }
 
+  bool joinTraversal(MisraTraversal &Traversal) override {
+    if (!Traversal.join(V, checkername))
+      return false;
+    V->setAncestors(&Traversal.getAncestors());
+    return true;
+  }
+
+  bool visitSystemHeaders() override { return V->shouldVisitSystemHeaders(); }
+
   void setDebugLoc(DebugLoc debug) override { V->Debug.debugloc = debug; }
 
+  void setCrossTU(CrossTUImporter *Importer) override {
+    V->setCrossTU(Importer);
+  }
+
   void regPPCallbacks(CompilerInstance &CI) override {
     Visitor->setPreprocessor(&CI.getPreprocessor());
-    CI.getPreprocessor().addPPCallbacks(std::move(Visitor));
+    addTimedPPCallbacks(CI, std::move(Visitor));
   }
 };
 
@@ -145,27 +199,128 @@ public:
     Visitor->handlePost();
   }
 
+  bool joinTraversal(MisraTraversal &Traversal) override {
+    if (!Traversal.join(Visitor, checkername))
+      return false;
+    Visitor->setAncestors(&Traversal.getAncestors());
+    return true;
+  }
+
+  bool visitSystemHeaders() override {
+    return Visitor->shouldVisitSystemHeaders();
+  }
+
+  void setDebugLoc(DebugLoc debug) override { Visitor->Debug.debugloc = debug; }
+
+  void setCrossTU(CrossTUImporter *Importer) override {
+    Visitor->setCrossTU(Importer);
+  }
+};
+
+//特化4
+template <class VisitorClass> // VisitorClass Should be MisraVisitor
+class Plugin_VisitorChecker<VisitorClass,
+                            ast_matchers::MatchFinder::MatchCallback>
+    : public Misrabase {
+private:
+  std::unique_ptr<VisitorClass> Visitor;
+
+public:
+  void Init(ASTContext &Context, MisraReport::MisraBugReport &mbr) override {
+    Visitor.reset(new VisitorClass(&Context, mbr));
+    Visitor->Init();
+  }
+
+  // Without a shared MatchFinder the checker matches the TU by itself
+  void runChecker(ASTContext &Context) override {
+    ast_matchers::MatchFinder Finder;
+    Visitor->registerMatchers(Finder);
+    Finder.matchAST(Context);
+  }
+
+  bool joinMatchFinder(ast_matchers::MatchFinder &Finder) override {
+    Visitor->registerMatchers(Finder);
+    return true;
+  }
+
   void setDebugLoc(DebugLoc debug) override { Visitor->Debug.debugloc = debug; }
+
+  void setCrossTU(CrossTUImporter *Importer) override {
+    Visitor->setCrossTU(Importer);
+  }
+};
+
+// Decl-local checker, see REGISTER_LOCAL_VISITOR_CHECKER
+template <typename Checker> class DeclLocal : public Checker {
+public:
+  bool isDeclLocal() override { return true; }
+};
+
+// Compile-time checker table, see REGISTER_CHECKER in plugin_registry.h
+struct CheckerInfo {
+  const char *name;
+  const char *desc;
+  const char *kind; // visitor, ctu_visitor, local_visitor or ast_matcher
 };
 
+typedef Misrabase *(*checker_factory_t)();
+typedef const CheckerInfo &(*checker_info_t)();
+
+struct CheckerEntry {
+  const char *id;
+  checker_factory_t create;
+  checker_info_t info;
+};
+
+// Binary search of the checker table, nullptr if id is unknown
+const CheckerEntry *findChecker(StringRef id);
+// The whole table, sorted by id
+ArrayRef<CheckerEntry> getCheckerTable();
+
 class MisraManager {
 public:
-  MisraManager() {}
+  // The manager hands out the checkers registered with one of kinds
+  explicit MisraManager(std::vector<std::string> kinds) : Kinds(kinds) {}
 
 private:
-  std::map<std::string, std::pair<Misrabase *, std::string>> CheckerTable;
+  std::vector<std::string> Kinds;
+  // Checkers are created the first time they are asked for
+  std::map<std::string, std::unique_ptr<Misrabase>> Checkers;
+
+  bool isManaged(const CheckerEntry *entry) const {
+    return entry && std::find(Kinds.begin(), Kinds.end(),
+                              entry->info().kind) != Kinds.end();
+  }
 
 public:
-  template <class Visitor> int addChecker(std::string name, std::string desc) {
-    Visitor *checker = new Visitor();
-    Misrabase *ref = checker;
-    std::pair<Misrabase *, std::string> registry(ref, desc);
-    CheckerTable.insert(
-        std::pair<std::string, std::pair<Misrabase *, std::string>>(name,
-                                                                    registry));
-    return 1;
-  }
-  std::map<std::string, std::pair<Misrabase *, std::string>> getChecker() {
-    return CheckerTable;
+  bool hasChecker(const std::string &name) const {
+    return isManaged(findChecker(name));
+  }
+
+  size_t size() const {
+    size_t num = 0;
+    for (auto &entry : getCheckerTable())
+      num += isManaged(&entry);
+    return num;
+  }
+
+  // Return the checker called name, nullptr if there is none. The pointer is
+  // owned by the manager and stays valid as long as the manager.
+  Misrabase *getChecker(const std::string &name) {
+    auto it = Checkers.find(name);
+    if (it != Checkers.end())
+      return it->second.get();
+
+    const CheckerEntry *entry = findChecker(name);
+    if (!isManaged(entry))
+      return nullptr;
+    Misrabase *checker = entry->create();
+    Checkers[name].reset(checker);
+    return checker;
+  }
+
+  std::string getDescription(const std::string &name) const {
+    const CheckerEntry *entry = findChecker(name);
+    return entry ? entry->info().desc : std::string();
   }
 };
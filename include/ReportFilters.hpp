@@ -0,0 +1,75 @@
+#pragma once
+#include "MisraTraversal.hpp"
+#include "Reporter.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace MisraReport {
+
+/* The filters of misra-scan's reportfilters.py, run on the diagnostics of the
+ * TU before the report is written. A dropped diagnostic never reaches disk,
+ * the count of each filter goes into the stats as plugin.filter.<name>.
+ * misra-scan still runs its filters on the merged diagnostics. R2_3Filter is
+ * left to misra-scan, a referenced declaration in one TU suppresses an unused
+ * one in another.
+ */
+class ReportFilterBase {
+public:
+  virtual ~ReportFilterBase() = default;
+
+  virtual const char *name() const = 0;
+
+  // One entry per diagnostic, true to keep it. The locations are resolved,
+  // Files names the files they refer to.
+  virtual std::vector<bool>
+  generateFilterMask(const std::vector<Diag> &diagnostics,
+                     const FileTable &Files) = 0;
+};
+
+// The file the diagnostic is shown in is gone
+class FileMissingFilter : public ReportFilterBase {
+public:
+  const char *name() const override { return "file_missing"; }
+  std::vector<bool> generateFilterMask(const std::vector<Diag> &diagnostics,
+                                       const FileTable &Files) override;
+};
+
+class MisraCCategoryFilter : public ReportFilterBase {
+public:
+  const char *name() const override { return "category"; }
+  std::vector<bool> generateFilterMask(const std::vector<Diag> &diagnostics,
+                                       const FileTable &Files) override;
+};
+
+// Some rules are not reported through a macro defined outside the project.
+// misra-scan asks for a path outside its working directory, here the
+// SourceManager knows the system headers and the project roots are given.
+class UseSystemMacroFilter : public ReportFilterBase {
+private:
+  SourceFilter Filter;
+
+public:
+  UseSystemMacroFilter(const SourceManager &SM,
+                       const std::vector<std::string> &ProjectRoots)
+      : Filter(SM, ProjectRoots) {}
+
+  const char *name() const override { return "system_macro"; }
+  std::vector<bool> generateFilterMask(const std::vector<Diag> &diagnostics,
+                                       const FileTable &Files) override;
+};
+
+class ReportFilterManager {
+private:
+  std::vector<std::unique_ptr<ReportFilterBase>> Filters;
+
+public:
+  // The filters of reportfilters.py which work on one TU, in the same order
+  ReportFilterManager(const SourceManager &SM,
+                      const std::vector<std::string> &ProjectRoots);
+
+  void run(MisraBugReport &MBR);
+};
+
+} // namespace MisraReport
@@ -7,10 +7,21 @@
 #include "clang/Basic/Version.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendAction.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <set>
+#include <sstream>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <nlohmann/json.hpp>
@@ -22,82 +33,110 @@ using namespace clang;
 
 namespace MisraReport {
 
+// Table of the file paths of one report. A location keeps the ID of its file
+// instead of a copy of the path. Paths are interned when the report resolves
+// its locations, after the worker threads are done.
+class FileTable {
+private:
+  unordered_map<string, unsigned> IDs;
+  vector<const string *> Names; // keys of IDs, which stay where they are
+  unordered_map<unsigned, string> RealNames;
+
+public:
+  // ID 0 is the empty path of a location that was never set
+  FileTable() { intern(""); }
+
+  unsigned intern(const string &file) {
+    auto it = IDs.emplace(file, Names.size());
+    if (it.second)
+      Names.push_back(&it.first->first);
+    return it.first->second;
+  }
+
+  const string &name(unsigned id) const { return *Names[id]; }
+
+  // The reports name files by their real path, misra-scan needn't rewrite them
+  const string &realName(unsigned id) {
+    auto it = RealNames.find(id);
+    if (it != RealNames.end())
+      return it->second;
+    llvm::SmallString<256> RealPath;
+    if (Names[id]->empty() || llvm::sys::fs::real_path(*Names[id], RealPath))
+      return RealNames[id] = *Names[id];
+    return RealNames[id] = RealPath.str();
+  }
+
+  // Forget the paths of the TU, IDs start over
+  void clear() {
+    unordered_map<string, unsigned>().swap(IDs);
+    vector<const string *>().swap(Names);
+    unordered_map<unsigned, string>().swap(RealNames);
+    intern("");
+  }
+};
+
+// FileTable ID to the index of the file in the "files" table of a report
+typedef unordered_map<unsigned, unsigned> FileIndex;
+
 class Issue {
+  friend class MisraBugReport;
+
 private:
   string kind;
+  // A location set from a SourceLocation keeps its raw encoding, the report
+  // resolves all of them in one batch before it is written
   typedef struct {
+    unsigned raw;
+    bool resolved;
     int line;
     int col;
-    string file;
-    json &CreateJson() {
-      json *j = new json({{"line", line}, {"column", col}, {"file", file}});
-      return *j;
+    unsigned file;
+    void set(clang::SourceLocation Loc) {
+      raw = Loc.getRawEncoding();
+      resolved = false;
+    }
+    void set(int l, int c, unsigned f) {
+      line = l;
+      col = c;
+      file = f;
+      resolved = true;
+    }
+    json CreateJson(const FileIndex &index) const {
+      return json({{"line", line}, {"column", col}, {"file", index.at(file)}});
+    }
+    // Keys in the order json objects sort them, as CreateJson().dump()
+    void WriteJson(std::ostream &os, const FileIndex &index) const {
+      os << "{\"column\":" << col << ",\"file\":" << index.at(file)
+         << ",\"line\":" << line << "}";
     }
   } location;
 
-  location loc;
+  location loc = location();
   pair<location, location> range;
   int depth;
   string msg;
   string ext_msg;
 
 public:
-  string getfile() { return loc.file; }
-
-  void setloc(int line, int col, string file) {
-    loc.line = line;
-    loc.col = col;
-    loc.file = file;
-  }
-
-  void setloc(clang::FullSourceLoc fullloc) {
-    if (fullloc.isFileID()) {
-      loc.line = fullloc.getPresumedLoc().getLine();
-      loc.col = fullloc.getPresumedLoc().getColumn();
-      loc.file = fullloc.getPresumedLoc().getFilename();
-    } else {
-      auto Exloc = fullloc.getManager().getExpansionLoc(fullloc);
-      clang::FullSourceLoc Exfull{Exloc, fullloc.getManager()};
-      setloc(Exfull);
-    }
-  }
-
-  void setBegin(clang::FullSourceLoc fullloc) {
-    if (fullloc.isFileID()) {
-      range.first.line = fullloc.getPresumedLoc().getLine();
-      range.first.col = fullloc.getPresumedLoc().getColumn();
-      range.first.file = fullloc.getPresumedLoc().getFilename();
-    } else {
-      auto Exloc = fullloc.getManager().getExpansionLoc(fullloc);
-      clang::FullSourceLoc Exfull{Exloc, fullloc.getManager()};
-      setBegin(Exfull);
-    }
-  }
-
-  void setEnd(clang::FullSourceLoc fullloc) {
-    if (fullloc.isFileID()) {
-      range.second.line = fullloc.getPresumedLoc().getLine();
-      range.second.col = fullloc.getPresumedLoc().getColumn();
-      range.second.file = fullloc.getPresumedLoc().getFilename();
-
-    } else {
-      auto Exloc = fullloc.getManager().getExpansionLoc(fullloc);
-      clang::FullSourceLoc Exfull{Exloc, fullloc.getManager()};
-      setEnd(Exfull);
-    }
+  const string &getkind() const { return kind; }
+  const string &getextmsg() const { return ext_msg; }
+  // Invalid for a location that was never set
+  clang::SourceLocation getrawloc() const {
+    return clang::SourceLocation::getFromRawEncoding(loc.raw);
   }
 
-  void setBegin(int line, int col, string file) {
-    range.first.line = line;
-    range.first.col = col;
-    range.first.file = file;
+  // FileTable IDs of the location and of the range
+  void getFileIDs(unsigned ids[3]) const {
+    ids[0] = loc.file;
+    ids[1] = range.first.file;
+    ids[2] = range.second.file;
   }
 
-  void setEnd(int line, int col, string file) {
-    range.second.line = line;
-    range.second.col = col;
-    range.second.file = file;
-  }
+  // The SourceManager must be the one given to the report, macro locations
+  // are reported at their expansion
+  void setloc(clang::FullSourceLoc fullloc) { loc.set(fullloc); }
+  void setBegin(clang::FullSourceLoc fullloc) { range.first.set(fullloc); }
+  void setEnd(clang::FullSourceLoc fullloc) { range.second.set(fullloc); }
 
   bool setMsg(string m) {
     if (m.size() == 0) {
@@ -123,16 +162,29 @@ public:
 
   void setKind(string k) { kind = k; }
 
-  json CreateJson() {
+  json CreateJson(const FileIndex &index) const {
     json j;
     j["message"] = msg;
     j["kind"] = kind;
     j["depth"] = depth;
     j["extended_message"] = ext_msg;
-    j["location"] = loc.CreateJson();
-    j["ranges"] = {range.first.CreateJson(), range.second.CreateJson()};
+    j["location"] = loc.CreateJson(index);
+    j["ranges"] = {range.first.CreateJson(index),
+                   range.second.CreateJson(index)};
     return j;
   }
+
+  // Same output as CreateJson(index).dump()
+  void WriteJson(std::ostream &os, const FileIndex &index) const {
+    os << "{\"depth\":" << depth << ",\"extended_message\":" << json(ext_msg)
+       << ",\"kind\":" << json(kind) << ",\"location\":";
+    loc.WriteJson(os, index);
+    os << ",\"message\":" << json(msg) << ",\"ranges\":[";
+    range.first.WriteJson(os, index);
+    os << ",";
+    range.second.WriteJson(os, index);
+    os << "]}";
+  }
 };
 
 class Diag {
@@ -144,14 +196,6 @@ public:
   string checkname;
 
 public:
-  set<string> getFileList() {
-    set<string> *ret = new set<string>();
-    for (auto it : path) {
-      ret->insert(it.getfile());
-    }
-    return *ret;
-  }
-
   void setinfo(string desc, string cat, string t, string name) {
     describe = desc;
     category = cat;
@@ -159,45 +203,479 @@ public:
     checkname = name;
   }
 
-  json CreateJson() {
+  json CreateJson(const FileIndex &index) const {
     json j;
     j["description"] = describe;
     j["category"] = category;
     j["type"] = type;
     j["check_name"] = checkname;
-    for (auto it : path) {
-      j["path"].push_back(it.CreateJson());
+    for (auto &it : path) {
+      j["path"].push_back(it.CreateJson(index));
     }
     return j;
   }
+
+  // Same output as CreateJson(index).dump(), "path" is left out when empty
+  void WriteJson(std::ostream &os, const FileIndex &index) const {
+    os << "{\"category\":" << json(category)
+       << ",\"check_name\":" << json(checkname)
+       << ",\"description\":" << json(describe);
+    if (!path.empty()) {
+      os << ",\"path\":[";
+      for (size_t i = 0; i < path.size(); ++i) {
+        if (i)
+          os << ",";
+        path[i].WriteJson(os, index);
+      }
+      os << "]";
+    }
+    os << ",\"type\":" << json(type) << "}";
+  }
+};
+
+// Cost of one checker or one phase of the plugin for the TU
+class Stat {
+public:
+  double wall_time = 0; // seconds
+  uint64_t nodes = 0;   // AST nodes, matches or hook calls handled
+  uint64_t diagnostics = 0;
+
+  json CreateJson() {
+    json j;
+    j["wall_time"] = wall_time;
+    j["nodes"] = nodes;
+    j["diagnostics"] = diagnostics;
+    return j;
+  }
 };
 
+enum class ReportFormat { JSON, CBOR, MsgPack };
+
 class MisraBugReport {
 public:
   string version;
-  set<string> files;
   vector<Diag> diagnostics;
 
+private:
+  // Keyed by check name for checkers, by phase for the rest of the plugin
+  map<string, Stat> stats;
+  std::mutex StatLock;
+
+  // When checkers run on a thread pool every job reports into its own buffer,
+  // the buffers are merged in job order so the report doesn't depend on
+  // scheduling
+  vector<vector<Diag>> JobBuffers;
+
+  static vector<Diag> *&currentBuffer() {
+    static thread_local vector<Diag> *Buffer = nullptr;
+    return Buffer;
+  }
+
+  const clang::SourceManager *SM = nullptr;
+
+  // Paths of the files the resolved locations refer to
+  FileTable Files;
+
+  // Quiet reports are only written to the report, not rendered by clang
+  bool quiet = false;
+  unsigned DiagIDs[2] = {0, 0};
+
+  // A TU reports a violation in a header once, however often it is visited
+  unordered_set<string> seen;
+
+  // Check name, the locations and messages of the path. A raw location is
+  // unique within the TU, so the key is built before it is resolved.
+  static string DiagKey(const Diag &D) {
+    string key = D.checkname;
+    for (auto &I : D.path) {
+      for (auto *L : {&I.loc, &I.range.first, &I.range.second}) {
+        for (unsigned v : {L->raw, static_cast<unsigned>(L->line),
+                           static_cast<unsigned>(L->col), L->file})
+          key.append(reinterpret_cast<const char *>(&v), sizeof(v));
+      }
+      key.append(I.msg);
+      key.push_back('\0');
+    }
+    return key;
+  }
+
+  // Turn the raw locations of the issues into file, line and column. They are
+  // resolved sorted by FileID and offset, the line cache of the SourceManager
+  // then walks every file forward once.
+  void resolveLocations() {
+    struct Pending {
+      clang::FileID FID;
+      unsigned offset;
+      clang::SourceLocation Loc;
+      Issue::location *L;
+    };
+    vector<Pending> pending;
+    for (auto &D : diagnostics) {
+      for (auto &I : D.path) {
+        for (auto *L : {&I.loc, &I.range.first, &I.range.second}) {
+          if (L->resolved)
+            continue;
+          auto Loc = clang::SourceLocation::getFromRawEncoding(L->raw);
+          if (!SM || Loc.isInvalid()) {
+            L->set(0, 0, 0);
+            continue;
+          }
+          Loc = SM->getExpansionLoc(Loc);
+          auto Decomposed = SM->getDecomposedLoc(Loc);
+          pending.push_back({Decomposed.first, Decomposed.second, Loc, L});
+        }
+      }
+    }
+    std::sort(pending.begin(), pending.end(),
+              [](const Pending &A, const Pending &B) {
+                if (A.FID != B.FID)
+                  return A.FID < B.FID;
+                return A.offset < B.offset;
+              });
+
+    const char *lastname = nullptr;
+    unsigned lastfile = 0;
+    for (auto &P : pending) {
+      clang::PresumedLoc PLoc = SM->getPresumedLoc(P.Loc);
+      if (PLoc.isInvalid()) {
+        P.L->set(0, 0, 0);
+        continue;
+      }
+      // #line may rename a file, most of the time it is still the last one
+      if (PLoc.getFilename() != lastname) {
+        lastname = PLoc.getFilename();
+        lastfile = Files.intern(lastname);
+      }
+      P.L->line = PLoc.getLine();
+      P.L->col = PLoc.getColumn();
+      P.L->file = lastfile;
+      P.L->resolved = true;
+    }
+  }
+
 public:
+  // Issues keep raw SourceLocations of this manager until the report is
+  // written, it has to live until then
+  void setSourceManager(const clang::SourceManager &SM) { this->SM = &SM; }
+
+  void setQuiet(bool q) { quiet = q; }
+  bool isQuiet() const { return quiet; }
+
+  // Custom DiagnosticsEngine ID of the TU for warnings with and without an
+  // extended message, 0 until ReportHelper looks it up
+  unsigned &getDiagID(bool withExtMsg) { return DiagIDs[withExtMsg]; }
+
   void AddDiag(Diag diag) {
-    auto f = diag.getFileList();
-    files.insert(f.begin(), f.end());
-    diagnostics.push_back(diag);
+    if (auto *Buffer = currentBuffer()) {
+      Buffer->push_back(std::move(diag));
+      return;
+    }
+    if (!seen.insert(DiagKey(diag)).second) {
+      addStat("plugin.duplicates", 0, 0, 1);
+      return;
+    }
+    addStat(diag.checkname, 0, 0, 1);
+    diagnostics.push_back(std::move(diag));
+  }
+
+  // Can be called from the worker threads
+  void addStat(const string &name, double wall_time, uint64_t nodes = 0,
+               uint64_t diags = 0) {
+    std::lock_guard<std::mutex> Guard(StatLock);
+    Stat &S = stats[name];
+    S.wall_time += wall_time;
+    S.nodes += nodes;
+    S.diagnostics += diags;
+  }
+
+  void beginJobs(size_t num_jobs) {
+    JobBuffers.clear();
+    JobBuffers.resize(num_jobs);
+  }
+  // Called on the worker thread around each job
+  void enterJob(size_t job) { currentBuffer() = &JobBuffers[job]; }
+  void leaveJob() { currentBuffer() = nullptr; }
+
+  void mergeJobs() {
+    for (auto &Buffer : JobBuffers)
+      for (auto &D : Buffer)
+        AddDiag(std::move(D));
+    JobBuffers.clear();
+  }
+
+  // Give back the memory of the diagnostics once the report is written
+  void clear() {
+    vector<Diag>().swap(diagnostics);
+    unordered_set<string>().swap(seen);
+    vector<vector<Diag>>().swap(JobBuffers);
+    Files.clear();
+    std::lock_guard<std::mutex> Guard(StatLock);
+    stats.clear();
   }
 
   int getDiagSize() { return diagnostics.size(); }
 
+  // Leave out the diagnostics located in files for which Claim returns false,
+  // it is asked once per file
+  void claimFiles(const std::function<bool(const string &)> &Claim) {
+    resolveLocations();
+    unordered_map<unsigned, bool> claimed;
+    auto isClaimed = [&](const Diag &D) {
+      if (D.path.empty())
+        return true;
+      unsigned file = D.path.front().loc.file;
+      auto it = claimed.find(file);
+      if (it == claimed.end())
+        it = claimed.emplace(file, Claim(Files.name(file))).first;
+      return it->second;
+    };
+    size_t before = diagnostics.size();
+    diagnostics.erase(std::remove_if(diagnostics.begin(), diagnostics.end(),
+                                     [&](const Diag &D) {
+                                       return !isClaimed(D);
+                                     }),
+                      diagnostics.end());
+    if (before != diagnostics.size())
+      addStat("plugin.claimed_elsewhere", 0, 0, before - diagnostics.size());
+  }
+
+  // Leave out the diagnostics for which the mask of Filter is false, they
+  // are counted in the stat Name. Filter gets the table naming their files.
+  void filterDiagnostics(
+      const std::function<vector<bool>(const vector<Diag> &,
+                                       const FileTable &)> &Filter,
+      const string &Name) {
+    if (diagnostics.empty())
+      return;
+    resolveLocations();
+    vector<bool> mask = Filter(diagnostics, Files);
+    size_t kept = 0;
+    for (size_t i = 0; i < diagnostics.size(); ++i) {
+      if (!mask[i])
+        continue;
+      if (kept != i)
+        diagnostics[kept] = std::move(diagnostics[i]);
+      ++kept;
+    }
+    if (kept != diagnostics.size()) {
+      addStat(Name, 0, 0, diagnostics.size() - kept);
+      diagnostics.resize(kept);
+    }
+  }
+
+  void AddFiles(const Diag &D, FileIndex &index, vector<string> &files) {
+    for (auto &I : D.path) {
+      unsigned ids[3];
+      I.getFileIDs(ids);
+      for (unsigned id : ids) {
+        if (index.emplace(id, files.size()).second)
+          files.push_back(Files.realName(id));
+      }
+    }
+  }
+
+  // The "files" table of the report, files are numbered in the order the
+  // diagnostics first refer to them
+  vector<string> CreateFileTable(FileIndex &index) {
+    vector<string> files;
+    for (auto &D : diagnostics)
+      AddFiles(D, index, files);
+    return files;
+  }
+
+  // The file misra-scan shows a diagnostic in, the one of the deepest event
+  // of its path
+  static unsigned getMainFile(const Diag &D) {
+    const Issue *Main = &D.path.front();
+    int depth = -1;
+    for (auto &I : D.path) {
+      if (I.kind == "event" && I.depth > depth) {
+        depth = I.depth;
+        Main = &I;
+      }
+    }
+    return Main->loc.file;
+  }
+
+  // Write the diagnostics into shards, one per file they are shown in.
+  // Append gets the real path of the file and one line for its shard: a
+  // report of this TU with the diagnostics of that file and the name of the
+  // per TU report, in the order CreateJson().dump() would write the keys.
+  void WriteShards(
+      const std::function<void(const string &, const string &)> &Append,
+      const string &report) {
+    resolveLocations();
+    version = clang::getClangFullVersion();
+    map<unsigned, vector<const Diag *>> shards;
+    for (auto &D : diagnostics)
+      if (!D.path.empty())
+        shards[getMainFile(D)].push_back(&D);
+
+    for (auto &shard : shards) {
+      FileIndex index;
+      vector<string> files;
+      for (auto *D : shard.second)
+        AddFiles(*D, index, files);
+
+      std::ostringstream line;
+      line << "{\"clang_version\":" << json(version) << ",\"diagnostics\":[";
+      for (size_t i = 0; i < shard.second.size(); ++i) {
+        if (i)
+          line << ",";
+        shard.second[i]->WriteJson(line, index);
+      }
+      line << "],\"files\":" << json(files) << ",\"report\":" << json(report)
+           << "}\n";
+      Append(Files.realName(shard.first), line.str());
+    }
+  }
+
+  // The diagnostics went to the shards, the report keeps the stats
+  void clearDiagnostics() { vector<Diag>().swap(diagnostics); }
+
   json CreateJson() {
     json j;
+    FileIndex index;
+    resolveLocations();
     version = clang::getClangFullVersion();
     j["clang_version"] = clang::getClangFullVersion();
-    j["files"] = files;
-    for (auto it : diagnostics)
-      j["diagnostics"].push_back(it.CreateJson());
+    j["files"] = CreateFileTable(index);
+    for (auto &it : diagnostics)
+      j["diagnostics"].push_back(it.CreateJson(index));
+    j["stats"] = CreateStatsJson();
+
+    return j;
+  }
+
+  // Write the same bytes as CreateJson().dump() one diagnostic at a time,
+  // without building the DOM of the whole report. The time it takes up to the
+  // stats goes into the stats as plugin.report.
+  void WriteJson(std::ostream &os) {
+    auto start = std::chrono::steady_clock::now();
+    FileIndex index;
+    resolveLocations();
+    vector<string> files = CreateFileTable(index);
+    version = clang::getClangFullVersion();
+    os << "{\"clang_version\":" << json(version);
+    if (!diagnostics.empty()) {
+      os << ",\"diagnostics\":[";
+      for (size_t i = 0; i < diagnostics.size(); ++i) {
+        if (i)
+          os << ",";
+        diagnostics[i].WriteJson(os, index);
+      }
+      os << "]";
+    }
+    os << ",\"files\":" << json(files);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    addStat("plugin.report", elapsed.count());
+    os << ",\"stats\":" << CreateStatsJson() << "}";
+  }
+
+  // Write the same bytes as json::to_cbor or json::to_msgpack of CreateJson(),
+  // only the DOM of one diagnostic at a time is built
+  void WriteBinary(std::ostream &os, ReportFormat format) {
+    auto start = std::chrono::steady_clock::now();
+    auto write = [&os, format](const json &j) {
+      if (format == ReportFormat::CBOR)
+        json::to_cbor(j, os);
+      else
+        json::to_msgpack(j, os);
+    };
+
+    FileIndex index;
+    resolveLocations();
+    vector<string> files = CreateFileTable(index);
+    version = clang::getClangFullVersion();
+    WriteBinaryHeader(os, format, true, diagnostics.empty() ? 3 : 4);
+    write("clang_version");
+    write(version);
+    if (!diagnostics.empty()) {
+      write("diagnostics");
+      WriteBinaryHeader(os, format, false, diagnostics.size());
+      for (auto &it : diagnostics)
+        write(it.CreateJson(index));
+    }
+    write("files");
+    write(files);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    addStat("plugin.report", elapsed.count());
+    write("stats");
+    write(CreateStatsJson());
+  }
+
+private:
+  // Header of a map of n pairs or an array of n items, sized the way the
+  // binary_writer of nlohmann::json sizes it
+  static void WriteBinaryHeader(std::ostream &os, ReportFormat format,
+                                bool map, uint64_t n) {
+    auto put = [&os](uint64_t value, int bytes) {
+      for (int i = bytes - 1; i >= 0; --i)
+        os.put(static_cast<char>((value >> (8 * i)) & 0xff));
+    };
+
+    if (format == ReportFormat::CBOR) {
+      uint8_t major = map ? 0xa0 : 0x80;
+      if (n <= 0x17) {
+        put(major | n, 1);
+      } else if (n <= 0xff) {
+        put(major | 0x18, 1);
+        put(n, 1);
+      } else if (n <= 0xffff) {
+        put(major | 0x19, 1);
+        put(n, 2);
+      } else if (n <= 0xffffffff) {
+        put(major | 0x1a, 1);
+        put(n, 4);
+      } else {
+        put(major | 0x1b, 1);
+        put(n, 8);
+      }
+      return;
+    }
+
+    if (n <= 15) {
+      put((map ? 0x80 : 0x90) | n, 1);
+    } else if (n <= 0xffff) {
+      put(map ? 0xde : 0xdc, 1);
+      put(n, 2);
+    } else {
+      put(map ? 0xdf : 0xdd, 1);
+      put(n, 4);
+    }
+  }
+
+public:
 
+  json CreateStatsJson() {
+    std::lock_guard<std::mutex> Guard(StatLock);
+    json j = json::object();
+    for (auto &it : stats)
+      j[it.first] = it.second.CreateJson();
     return j;
   }
 };
 
+// Add the wall time of a scope to a stat
+class ScopedStat {
+private:
+  MisraBugReport &MBR;
+  string name;
+  std::chrono::steady_clock::time_point start;
+
+public:
+  uint64_t nodes = 0;
+
+  ScopedStat(MisraBugReport &MBR, string name)
+      : MBR(MBR), name(name), start(std::chrono::steady_clock::now()) {}
+  ~ScopedStat() {
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    MBR.addStat(name, elapsed.count(), nodes);
+  }
+};
+
 } // namespace MisraReport
 #endif
@@ -0,0 +1,244 @@
+#pragma once
+#include "clang/Lex/PPCallbacks.h"
+
+#include "Reporter.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+using namespace clang;
+
+/* Forward every preprocessor hook to the PPCallbacks of a checker and add up
+ * the time spent in them. The sum is added to the stat of the checker when the
+ * main file ends, the preprocessor may outlive the report.
+ */
+class TimedPPCallbacks : public PPCallbacks {
+private:
+  std::unique_ptr<PPCallbacks> Inner;
+  MisraReport::MisraBugReport &MBR;
+  std::string name;
+
+  double wall_time = 0;
+  uint64_t calls = 0;
+
+  class Timer {
+    TimedPPCallbacks &T;
+    std::chrono::steady_clock::time_point start;
+
+  public:
+    explicit Timer(TimedPPCallbacks &T)
+        : T(T), start(std::chrono::steady_clock::now()) {}
+    ~Timer() {
+      std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+      T.wall_time += elapsed.count();
+      ++T.calls;
+    }
+  };
+
+  void flush() {
+    if (calls == 0)
+      return;
+    MBR.addStat(name, wall_time, calls);
+    wall_time = 0;
+    calls = 0;
+  }
+
+public:
+  TimedPPCallbacks(std::unique_ptr<PPCallbacks> Inner,
+                   MisraReport::MisraBugReport &MBR, const std::string &name)
+      : Inner(std::move(Inner)), MBR(MBR), name(name) {}
+  ~TimedPPCallbacks() override { flush(); }
+
+  void FileChanged(SourceLocation Loc, FileChangeReason Reason,
+                   SrcMgr::CharacteristicKind FileType,
+                   FileID PrevFID) override {
+    Timer T(*this);
+    Inner->FileChanged(Loc, Reason, FileType, PrevFID);
+  }
+
+  void FileSkipped(const FileEntry &SkippedFile, const Token &FilenameTok,
+                   SrcMgr::CharacteristicKind FileType) override {
+    Timer T(*this);
+    Inner->FileSkipped(SkippedFile, FilenameTok, FileType);
+  }
+
+  bool FileNotFound(StringRef FileName,
+                    SmallVectorImpl<char> &RecoveryPath) override {
+    Timer T(*this);
+    return Inner->FileNotFound(FileName, RecoveryPath);
+  }
+
+  void InclusionDirective(SourceLocation HashLoc, const Token &IncludeTok,
+                          StringRef FileName, bool IsAngled,
+                          CharSourceRange FilenameRange, const FileEntry *File,
+                          StringRef SearchPath, StringRef RelativePath,
+                          const Module *Imported,
+                          SrcMgr::CharacteristicKind FileType) override {
+    Timer T(*this);
+    Inner->InclusionDirective(HashLoc, IncludeTok, FileName, IsAngled,
+                              FilenameRange, File, SearchPath, RelativePath,
+                              Imported, FileType);
+  }
+
+  void moduleImport(SourceLocation ImportLoc, ModuleIdPath Path,
+                    const Module *Imported) override {
+    Timer T(*this);
+    Inner->moduleImport(ImportLoc, Path, Imported);
+  }
+
+  void EndOfMainFile() override {
+    {
+      Timer T(*this);
+      Inner->EndOfMainFile();
+    }
+    flush();
+  }
+
+  void Ident(SourceLocation Loc, StringRef Str) override {
+    Timer T(*this);
+    Inner->Ident(Loc, Str);
+  }
+
+  void PragmaDirective(SourceLocation Loc,
+                       PragmaIntroducerKind Introducer) override {
+    Timer T(*this);
+    Inner->PragmaDirective(Loc, Introducer);
+  }
+
+  void PragmaComment(SourceLocation Loc, const IdentifierInfo *Kind,
+                     StringRef Str) override {
+    Timer T(*this);
+    Inner->PragmaComment(Loc, Kind, Str);
+  }
+
+  void PragmaDetectMismatch(SourceLocation Loc, StringRef Name,
+                            StringRef Value) override {
+    Timer T(*this);
+    Inner->PragmaDetectMismatch(Loc, Name, Value);
+  }
+
+  void PragmaDebug(SourceLocation Loc, StringRef DebugType) override {
+    Timer T(*this);
+    Inner->PragmaDebug(Loc, DebugType);
+  }
+
+  void PragmaMessage(SourceLocation Loc, StringRef Namespace,
+                     PragmaMessageKind Kind, StringRef Str) override {
+    Timer T(*this);
+    Inner->PragmaMessage(Loc, Namespace, Kind, Str);
+  }
+
+  void PragmaDiagnosticPush(SourceLocation Loc, StringRef Namespace) override {
+    Timer T(*this);
+    Inner->PragmaDiagnosticPush(Loc, Namespace);
+  }
+
+  void PragmaDiagnosticPop(SourceLocation Loc, StringRef Namespace) override {
+    Timer T(*this);
+    Inner->PragmaDiagnosticPop(Loc, Namespace);
+  }
+
+  void PragmaDiagnostic(SourceLocation Loc, StringRef Namespace,
+                        diag::Severity Mapping, StringRef Str) override {
+    Timer T(*this);
+    Inner->PragmaDiagnostic(Loc, Namespace, Mapping, Str);
+  }
+
+  void PragmaOpenCLExtension(SourceLocation NameLoc, const IdentifierInfo *Name,
+                             SourceLocation StateLoc, unsigned State) override {
+    Timer T(*this);
+    Inner->PragmaOpenCLExtension(NameLoc, Name, StateLoc, State);
+  }
+
+  void PragmaWarning(SourceLocation Loc, StringRef WarningSpec,
+                     ArrayRef<int> Ids) override {
+    Timer T(*this);
+    Inner->PragmaWarning(Loc, WarningSpec, Ids);
+  }
+
+  void PragmaWarningPush(SourceLocation Loc, int Level) override {
+    Timer T(*this);
+    Inner->PragmaWarningPush(Loc, Level);
+  }
+
+  void PragmaWarningPop(SourceLocation Loc) override {
+    Timer T(*this);
+    Inner->PragmaWarningPop(Loc);
+  }
+
+  void PragmaAssumeNonNullBegin(SourceLocation Loc) override {
+    Timer T(*this);
+    Inner->PragmaAssumeNonNullBegin(Loc);
+  }
+
+  void PragmaAssumeNonNullEnd(SourceLocation Loc) override {
+    Timer T(*this);
+    Inner->PragmaAssumeNonNullEnd(Loc);
+  }
+
+  void MacroExpands(const Token &MacroNameTok, const MacroDefinition &MD,
+                    SourceRange Range, const MacroArgs *Args) override {
+    Timer T(*this);
+    Inner->MacroExpands(MacroNameTok, MD, Range, Args);
+  }
+
+  void MacroDefined(const Token &MacroNameTok,
+                    const MacroDirective *MD) override {
+    Timer T(*this);
+    Inner->MacroDefined(MacroNameTok, MD);
+  }
+
+  void MacroUndefined(const Token &MacroNameTok, const MacroDefinition &MD,
+                      const MacroDirective *Undef) override {
+    Timer T(*this);
+    Inner->MacroUndefined(MacroNameTok, MD, Undef);
+  }
+
+  void Defined(const Token &MacroNameTok, const MacroDefinition &MD,
+               SourceRange Range) override {
+    Timer T(*this);
+    Inner->Defined(MacroNameTok, MD, Range);
+  }
+
+  void SourceRangeSkipped(SourceRange Range, SourceLocation EndifLoc) override {
+    Timer T(*this);
+    Inner->SourceRangeSkipped(Range, EndifLoc);
+  }
+
+  void If(SourceLocation Loc, SourceRange ConditionRange,
+          ConditionValueKind ConditionValue) override {
+    Timer T(*this);
+    Inner->If(Loc, ConditionRange, ConditionValue);
+  }
+
+  void Elif(SourceLocation Loc, SourceRange ConditionRange,
+            ConditionValueKind ConditionValue, SourceLocation IfLoc) override {
+    Timer T(*this);
+    Inner->Elif(Loc, ConditionRange, ConditionValue, IfLoc);
+  }
+
+  void Ifdef(SourceLocation Loc, const Token &MacroNameTok,
+             const MacroDefinition &MD) override {
+    Timer T(*this);
+    Inner->Ifdef(Loc, MacroNameTok, MD);
+  }
+
+  void Ifndef(SourceLocation Loc, const Token &MacroNameTok,
+              const MacroDefinition &MD) override {
+    Timer T(*this);
+    Inner->Ifndef(Loc, MacroNameTok, MD);
+  }
+
+  void Else(SourceLocation Loc, SourceLocation IfLoc) override {
+    Timer T(*this);
+    Inner->Else(Loc, IfLoc);
+  }
+
+  void Endif(SourceLocation Loc, SourceLocation IfLoc) override {
+    Timer T(*this);
+    Inner->Endif(Loc, IfLoc);
+  }
+};
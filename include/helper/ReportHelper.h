@@ -1,3 +1,6 @@
+#ifndef MISRA_HELPER_REPORTHELPER_H_
+#define MISRA_HELPER_REPORTHELPER_H_
+
 #include "clang/AST/ASTConsumer.h"
 #include "clang/AST/ASTContext.h"
 #include "clang/AST/RecursiveASTVisitor.h"
@@ -14,6 +17,7 @@
 //#include "MisraVisitor.hpp"
 #include "Reporter.hpp"
 #include <iostream>
+#include <mutex>
 #include <string>
 
 using namespace clang;
@@ -21,6 +25,10 @@ using namespace ento;
 
 class ReportHelper {
 public:
+  // DiagnosticsEngine, SourceManager and the ASTContext caches are not thread
+  // safe, hold this lock to use them while checkers run in parallel
+  static std::mutex &getLock();
+
   static MisraReport::Issue CreateIssue(const SourceManager &sm,
                                         const SourceLocation &Loc,
                                         const SourceRange &SR);
@@ -47,3 +55,4 @@ public:
                                      string checkername, string describe);
 
 }; // end of class ReportHelper
+#endif // MISRA_HELPER_REPORTHELPER_H_
@@ -12,6 +12,9 @@
 #include "clang/StaticAnalyzer/Core/CheckerManager.h"
 #include "clang/Tooling/Tooling.h"
 
+#include "helper/ReportHelper.h"
+
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -19,11 +22,15 @@ using namespace clang;
 
 class SrcHelper {
 public:
-  static std::vector<Token> &getTokens(ASTContext *Context, Preprocessor *PP,
-                                       SourceRange SR);
+  // The tokens are allocated in the ASTContext, they are freed with the TU
+  static ArrayRef<Token> getTokens(ASTContext *Context, Preprocessor *PP,
+                                   SourceRange SR);
 
+  // The SourceManager fills its caches on lookups, take the lock in case
+  // checkers run in parallel
   template <typename T>
   static StringRef getToken(ASTContext *Context, T *token) {
+    std::lock_guard<std::mutex> Guard(ReportHelper::getLock());
     const SourceManager &sm = Context->getSourceManager();
     const LangOptions lopt = Context->getLangOpts();
     SmallVector<char, 25> buffer;
@@ -33,13 +40,19 @@ public:
 
   template <typename T>
   static uint32_t getNodeLine(ASTContext *Context, T node) {
+    std::lock_guard<std::mutex> Guard(ReportHelper::getLock());
     const SourceManager &sm = Context->getSourceManager();
     return sm.getSpellingLineNumber(node.getLocStart());
   }
 
+  // The parent map is built on first use, take the lock in case checkers run
+  // in parallel
   template <typename T>
   static const T *getParent(ASTContext *Context, const Stmt *ST) {
+    std::lock_guard<std::mutex> Guard(ReportHelper::getLock());
     const auto &parents = Context->getParents(*ST);
+    if (parents.empty())
+      return nullptr;
     const T *retST = parents[0].get<T>();
     return retST;
   }
@@ -10,12 +10,12 @@
 using namespace clang;
 using namespace ento;
 
+// Analyzer checkers still register when the plugin is loaded
 using checkerlist = std::map<std::string, std::pair<std::string, std::string>>;
 checkerlist &getCheckersList();
 
 typedef void (*register_checker_callback_t)(
     clang::ento::CheckerRegistry &registry);
-typedef void (*plugin_callback)(MisraManager *mgr);
 
 extern "C" void add_analyzer_checker(register_checker_callback_t f,
                                      std::string name, std::string desc);
@@ -24,33 +24,65 @@ extern "C" void add_analyzer_ctu_checker(register_checker_callback_t f,
 
 void misra_analysis_register(CheckerRegistry &registry);
 
-#define gen_Register_proto(name)                                               \
-  extern "C" void add_plugin_##name##_checker(                                 \
-      plugin_callback f, string checkername, string decs);                     \
-  void misra_##name##_register(MisraManager *mgr);
+static constexpr bool hasPrefix(const char *s, const char *prefix) {
+  return !*prefix || (*s == *prefix && hasPrefix(s + 1, prefix + 1));
+}
 
+static constexpr bool equalsID(const char *a, const char *b) {
+  return *a == *b && (!*a || equalsID(a + 1, b + 1));
+}
+
+// Whether class Rule_X_Y_Z is registered as "MisraCPP.X_Y_Z" and, built from
+// the Checkers list, X_Y_Z is the stem of its file
+static constexpr bool isCheckerName(const char *class_name, const char *name,
+                                    const char *stem) {
+  return hasPrefix(class_name, "Rule_") && hasPrefix(name, "MisraCPP.") &&
+         equalsID(class_name + 5, name + 9) &&
+         (!stem || equalsID(class_name + 5, stem));
+}
+
+#define MISRA_STR(x) #x
+#define MISRA_XSTR(x) MISRA_STR(x)
+#ifdef MISRA_CHECKER_ID
+#define MISRA_CHECKER_STEM MISRA_XSTR(MISRA_CHECKER_ID)
+#else
+#define MISRA_CHECKER_STEM nullptr
+#endif
+
+/* Plugin checkers are registered at compile time
+ * lib/visitors/CMakeLists.txt turns the Checkers list into Checkers.def,
+ * sorted by rule ID, and lib/visitors/Registry.cpp builds a constexpr table
+ * of it. The checker of X_Y_Z.cpp must be class Rule_X_Y_Z registered as
+ * "MisraCPP.X_Y_Z", REGISTER_CHECKER asserts it against the file stem CMake
+ * passes as MISRA_CHECKER_ID. It only defines the two functions the table
+ * points to, nothing runs when the plugin is loaded.
+ */
 #define REGISTER_CHECKER(type, class_name, name_str, description_str)          \
-  void register_plugin_##class_name(MisraManager *mgr) {                       \
-    mgr->addChecker<type(class_name)>(name_str, description_str);              \
-  }                                                                            \
-  __attribute__((constructor)) static void init_registration() {               \
-    add_plugin_##type##_checker(&register_plugin_##class_name, name_str,       \
-                                description_str);                              \
+  static_assert(isCheckerName(#class_name, name_str, MISRA_CHECKER_STEM),      \
+                "the checker of X_Y_Z.cpp must be class Rule_X_Y_Z "           \
+                "registered as \"MisraCPP.X_Y_Z\"");                           \
+  Misrabase *misra_create_##class_name() { return new type(class_name)(); }   \
+  const CheckerInfo &misra_info_##class_name() {                               \
+    static const CheckerInfo info = {name_str, description_str, #type};        \
+    return info;                                                               \
   }
 
 /* How to Define New CheckerRegister
- * 1. Use gen_Register_proto to declare registor function and use gen_Register
- * to define function at MainRegister.cpp
- * 2. Define same name macro to expand the class of checker consumer
+ * Define a macro named as the kind which expands to the class of checker
+ * consumer, MisraManager picks the checkers by kind name
  */
-gen_Register_proto(visitor)
 #define visitor(class_name)                                                    \
   Plugin_VisitorChecker<class_name, WhatKind<class_name>>
 
-    gen_Register_proto(ctu_visitor)
 #define ctu_visitor(class_name)                                                \
   Plugin_VisitorChecker<class_name, WhatKind<class_name>>
 
+#define local_visitor(class_name)                                              \
+  DeclLocal<Plugin_VisitorChecker<class_name, WhatKind<class_name>>>
+
+#define ast_matcher(class_name)                                                \
+  Plugin_VisitorChecker<class_name, WhatKind<class_name>>
+
 // Support Old Checker Register
 #define REGISTER_VISITOR_CHECKER(class_name, name_str, description_str)        \
   REGISTER_CHECKER(visitor, class_name, name_str, description_str)
@@ -58,6 +90,19 @@ gen_Register_proto(visitor)
 #define REGISTER_CTUVISITOR_CHECKER(class_name, name_str, description_str)     \
   REGISTER_CHECKER(ctu_visitor, class_name, name_str, description_str)
 
+// A visitor checker whose result for a top level decl depends only on that
+// decl and the ones parsed before it. With -stream it runs as each top level
+// decl is parsed instead of after the whole TU.
+#define REGISTER_LOCAL_VISITOR_CHECKER(class_name, name_str, description_str)  \
+  REGISTER_CHECKER(local_visitor, class_name, name_str, description_str)
+
+// A checker deriving MatchFinder::MatchCallback with
+//   void registerMatchers(ast_matchers::MatchFinder &Finder);
+// All of them add their matchers to one MatchFinder which matches the TU once.
+// Use onStartOfTranslationUnit/onEndOfTranslationUnit for per TU work.
+#define REGISTER_MATCHER_CHECKER(class_name, name_str, description_str)        \
+  REGISTER_CHECKER(ast_matcher, class_name, name_str, description_str)
+
 #define REGISTER_aaCHECKER(class_name, name_str, description_str)              \
   void register_##class_name(::clang::ento::CheckerRegistry &registry) {       \
     registry.addChecker<class_name>(name_str, description_str);                \
@@ -45,10 +45,15 @@ public:
     describe = desc;
   }
   void setPreprocessor(Preprocessor *Pp) { PP = Pp; }
+  void setAncestors(const AncestorStack *AS) { Ancestors = AS; }
+  void setCrossTU(CrossTUImporter *Importer) { CrossTU = Importer; }
 
   virtual void handlePre(){};
   virtual void handlePost(){};
   virtual void Init(){};
+  // Override to return true if the checker must see the decls of system
+  // headers and of files outside the project roots in the fused traversal
+  virtual bool shouldVisitSystemHeaders() { return false; }
   //=============================================================================================
 private:
   enum Kind { Plugin, SubVisitor } kind;
@@ -59,6 +64,11 @@ private:
   string checkname;
   string describe;
 
+  // Set while the checker runs in a MisraTraversal
+  const AncestorStack *Ancestors = nullptr;
+  // Set when the plugin runs with CTU
+  CrossTUImporter *CrossTU = nullptr;
+
 protected:
   ASTContext *Context;
   Preprocessor *PP;
@@ -127,7 +137,7 @@ public:
                                          describe);
   }
 
-  template <typename T> std::vector<Token> lexTokens(T decl) {
+  template <typename T> ArrayRef<Token> lexTokens(T decl) {
     return SrcHelper::getTokens(Context, PP, decl->getSourceRange());
   }
 
@@ -138,8 +148,58 @@ public:
                                   checkname, describe);
   }
 
+  // ASTContext memoizes type layouts, take the lock in case checkers run in
+  // parallel
+  TypeInfo getTypeInfo(const Type *T) {
+    std::lock_guard<std::mutex> Guard(ReportHelper::getLock());
+    return Context->getTypeInfo(T);
+  }
+  TypeInfo getTypeInfo(QualType T) { return getTypeInfo(T.getTypePtr()); }
+
+  // The SourceManager caches the last FileID and line table it looked up,
+  // take the lock in case checkers run in parallel
+  bool isInSystemHeader(SourceLocation Loc) {
+    std::lock_guard<std::mutex> Guard(ReportHelper::getLock());
+    return sm->isInSystemHeader(Loc);
+  }
+  unsigned getLine(SourceLocation Loc) {
+    std::lock_guard<std::mutex> Guard(ReportHelper::getLock());
+    return sm->getSpellingLineNumber(Loc);
+  }
+
+  // Parent stmt of S, nullptr if the parent is not a stmt. In a shared
+  // traversal the ancestor stack answers it, otherwise the ASTContext parent
+  // map, which is built for the whole TU on first use.
+  const Stmt *getParent(const Stmt *S) {
+    bool Found = false;
+    if (Ancestors) {
+      const Stmt *Parent = Ancestors->getParent(S, Found);
+      if (Found)
+        return Parent;
+    }
+    return SrcHelper::getParent<Stmt>(Context, S);
+  }
+
+  // Nearest ancestor of S of type T looking through Skip nodes, nullptr if
+  // another node comes first
+  template <typename T, typename Skip> const T *findAncestor(const Stmt *S) {
+    for (S = getParent(S); S && isa<Skip>(S); S = getParent(S))
+      ;
+    return dyn_cast_or_null<T>(S);
+  }
+
+  // Definition of the callee FD, imported from another TU if this one only
+  // declares it. nullptr if it isn't defined anywhere or CTU is off.
+  const FunctionDecl *getDefinition(const FunctionDecl *FD) {
+    const FunctionDecl *Definition;
+    if (FD->hasBody(Definition))
+      return Definition;
+    return CrossTU ? CrossTU->getDefinition(FD) : nullptr;
+  }
+
   // Return true if a is before b in source line of same file
   bool isBefore(const SourceLocation a, const SourceLocation b) {
+    std::lock_guard<std::mutex> Guard(ReportHelper::getLock());
     BeforeThanCompare<SourceLocation> compare(*sm);
     return compare(a, b);
   }
@@ -1,5 +1,10 @@
 #include "helper/ReportHelper.h"
 
+std::mutex &ReportHelper::getLock() {
+  static std::mutex Lock;
+  return Lock;
+}
+
 MisraReport::Issue ReportHelper::CreateIssue(const SourceManager &sm,
                                              const SourceLocation &Loc,
                                              const SourceRange &SR) {
@@ -33,6 +38,28 @@ MisraReport::Issue ReportHelper::CreateIssue(const SourceManager &sm,
   return i;
 }
 
+// Render the report as a clang warning too, unless the report is quiet. The
+// custom diagnostic IDs are looked up once per TU.
+static void EmitDiagnostic(const ASTContext *C, MisraReport::MisraBugReport &BR,
+                           SourceLocation Loc, SourceRange SR,
+                           const std::string &Msg, const std::string &ExtMsg) {
+  if (BR.isQuiet())
+    return;
+  auto &DE = C->getDiagnostics();
+  bool WithExtMsg = ExtMsg.compare(Msg) && ExtMsg.size() != 0;
+  unsigned &ID = BR.getDiagID(WithExtMsg);
+  if (!ID) {
+    ID = WithExtMsg ? DE.getCustomDiagID(clang::DiagnosticsEngine::Warning,
+                                         "%0\nExtMsg:%1")
+                    : DE.getCustomDiagID(clang::DiagnosticsEngine::Warning,
+                                         "%0\n");
+  }
+  DiagnosticBuilder DB = DE.Report(Loc, ID);
+  DB.AddString(Msg);
+  DB.AddString(ExtMsg);
+  DB.AddSourceRange(clang::CharSourceRange::getCharRange(SR));
+}
+
 /*
     template<typename T>
     static void balabala(const ASTContext *C, const T &token, std::string
@@ -69,28 +96,18 @@ void ReportHelper::SimpleBugReport(const ASTContext *C, SourceRange SR,
                                    string ExtMsg,
                                    MisraReport::MisraBugReport &BR,
                                    string checkername, string describe) {
-  unsigned ID;
+  std::lock_guard<std::mutex> Guard(getLock());
   auto &sm = C->getSourceManager();
-  auto &DE = C->getDiagnostics();
   SourceLocation Loc = SR.getBegin();
-  const auto Range = clang::CharSourceRange::getCharRange(SR);
 
   NoRule.insert(9, std::string(" 2008 "));
   Msg.insert(0, NoRule + ": ");
 
-  if (ExtMsg.compare(Msg) && ExtMsg.size() != 0) {
-    ID = DE.getCustomDiagID(clang::DiagnosticsEngine::Warning, "%0\nExtMsg:%1");
-  } else {
-    ID = DE.getCustomDiagID(clang::DiagnosticsEngine::Warning, "%0\n");
-  }
-  DiagnosticBuilder DB = DE.Report(Loc, ID);
-  DB.AddString(Msg);
-  DB.AddString(ExtMsg);
-  DB.AddSourceRange(Range);
+  EmitDiagnostic(C, BR, Loc, SR, Msg, ExtMsg);
 
   MisraReport::Diag D;
   MisraReport::Issue issue = CreateIssue(sm, Loc, SR, Msg, ExtMsg);
-  D.path.push_back(issue);
+  D.path.push_back(std::move(issue));
 
   { // TODO record all macro path, now we only report deepest
     SourceLocation loc = Loc;
@@ -100,12 +117,12 @@ void ReportHelper::SimpleBugReport(const ASTContext *C, SourceRange SR,
       // push issue with macro loc and empty msg
       MisraReport::Issue issue = CreateIssue(sm, loc, sr, string(), string());
       issue.setKind("macro");
-      D.path.push_back(issue);
+      D.path.push_back(std::move(issue));
     }
   }
 
   D.setinfo(describe, "MisraC", NoRule, checkername);
-  BR.AddDiag(D);
+  BR.AddDiag(std::move(D));
 }
 
 void ReportHelper::SimpleBugReportonMacro(const ASTContext *C, SourceRange SR,
@@ -113,11 +130,11 @@ void ReportHelper::SimpleBugReportonMacro(const ASTContext *C, SourceRange SR,
                                           string ExtMsg,
                                           MisraReport::MisraBugReport &BR,
                                           string checkername, string describe) {
-  unsigned ID;
+  std::lock_guard<std::mutex> Guard(getLock());
   auto &sm = C->getSourceManager();
-  auto &DE = C->getDiagnostics();
   SourceLocation Loc = SR.getBegin();
-  const auto Range = clang::CharSourceRange::getCharRange(SR);
+  // the warning keeps the range of the macro use
+  SourceRange UseSR = SR;
 
   NoRule.insert(9, std::string(" 2008 "));
   Msg.insert(0, NoRule + ": ");
@@ -129,21 +146,13 @@ void ReportHelper::SimpleBugReportonMacro(const ASTContext *C, SourceRange SR,
     }
   }
 
-  if (ExtMsg.compare(Msg) && ExtMsg.size() != 0) {
-    ID = DE.getCustomDiagID(clang::DiagnosticsEngine::Warning, "%0\nExtMsg:%1");
-  } else {
-    ID = DE.getCustomDiagID(clang::DiagnosticsEngine::Warning, "%0\n");
-  }
-  DiagnosticBuilder DB = DE.Report(Loc, ID);
-  DB.AddString(Msg);
-  DB.AddString(ExtMsg);
-  DB.AddSourceRange(Range);
+  EmitDiagnostic(C, BR, Loc, UseSR, Msg, ExtMsg);
 
   MisraReport::Issue issue = CreateIssue(sm, Loc, SR, Msg, ExtMsg);
   MisraReport::Diag D;
-  D.path.push_back(issue);
+  D.path.push_back(std::move(issue));
   D.setinfo(describe, "MisraC", NoRule, checkername);
-  BR.AddDiag(D);
+  BR.AddDiag(std::move(D));
 }
 
 /*
@@ -1,16 +1,21 @@
 #include "helper/SrcHelper.h"
-std::vector<Token> &SrcHelper::getTokens(ASTContext *Context, Preprocessor *PP,
-                                         SourceRange SR) {
-  std::vector<Token> *ret = new std::vector<Token>();
+ArrayRef<Token> SrcHelper::getTokens(ASTContext *Context, Preprocessor *PP,
+                                     SourceRange SR) {
+  // The Lexer and the allocator of the ASTContext are shared by the checkers
+  std::lock_guard<std::mutex> Guard(ReportHelper::getLock());
+  SmallVector<Token, 32> Tokens;
   Token Result;
   SourceLocation next = SR.getBegin();
   do {
     if (!PP->getRawToken(next, Result, true)) {
-      ret->push_back(Result);
+      Tokens.push_back(Result);
     }
     next = PP->getLocForEndOfToken(Result.getLocation());
   } while (isBefore(Context, next, SR.getEnd().getLocWithOffset(1)));
-  return *ret;
+
+  Token *ret = Context->Allocate<Token>(Tokens.size());
+  std::uninitialized_copy(Tokens.begin(), Tokens.end(), ret);
+  return ArrayRef<Token>(ret, Tokens.size());
 }
 
 bool SrcHelper::isBefore(ASTContext *Context, const SourceLocation a,
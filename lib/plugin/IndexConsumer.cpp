@@ -6,6 +6,7 @@
 
 #include "llvm/ADT/Optional.h"
 #include "llvm/Support/CachePruning.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/raw_ostream.h"
 
 #include "clang/AST/AST.h"
@@ -33,18 +34,17 @@
 
 #include <nlohmann/json.hpp>
 
+#include <set>
+#include <string>
+
 #include "MisraPlugin.h"
 
 void IndexConsumer ::Initialize(ASTContext &Context) {
-  fp.open(config.indexfile, std::ios::out);
   std::cout << "Create Index\n";
 }
 
 bool IndexConsumer ::HandleTopLevelDecl(DeclGroupRef DG) {
-  if (fp.fail()) {
-    std::cout << "index file set error\n";
-  }
-
+  MisraReport::ScopedStat Timer(*mbr, "plugin.index");
   for (DeclGroupRef::iterator i = DG.begin(), e = DG.end(); i != e; i++) {
     Decl *D = *i;
     if (auto *FD = dyn_cast<FunctionDecl>(D)) {
@@ -52,9 +52,8 @@ bool IndexConsumer ::HandleTopLevelDecl(DeclGroupRef DG) {
       if (index::generateUSRForDecl(FD, DeclUSR) || !FD->isDefined())
         continue;
       else {
-        std::cout << DeclUSR.str().str() << "\n";
-        fp << DeclUSR.str().str() << " "
-           << config.astdir + config.filename + ".ast" << std::endl;
+        Index.add(DeclUSR, config.astfile);
+        ++Timer.nodes;
       }
     }
   }
@@ -62,4 +61,42 @@ bool IndexConsumer ::HandleTopLevelDecl(DeclGroupRef DG) {
   return true;
 }
 
-void IndexConsumer::HandleTranslationUnit(ASTContext &Context) { fp.close(); }
+// USRs of the functions referenced in DC without a definition in the TU
+static void collectExterns(const DeclContext *DC,
+                           std::set<std::string> &Externs) {
+  for (const Decl *D : DC->decls()) {
+    if (const auto *SubDC = dyn_cast<DeclContext>(D))
+      collectExterns(SubDC, Externs);
+    const auto *FD = dyn_cast<FunctionDecl>(D);
+    if (!FD || !FD->isReferenced() || FD->isDefined())
+      continue;
+    SmallString<128> DeclUSR;
+    if (!index::generateUSRForDecl(FD, DeclUSR))
+      Externs.insert(DeclUSR.str());
+  }
+}
+
+// The static and shared builds of a source write the same .index and .extern
+// in parallel, each one is renamed into place whole
+void IndexConsumer::HandleTranslationUnit(ASTContext &Context) {
+  MisraReport::ScopedStat Timer(*mbr, "plugin.index");
+  std::string Data;
+  llvm::raw_string_ostream OS(Data);
+  Index.write(OS);
+  if (!ASTStore::writeAtomically(config.indexfile, OS.str())) {
+    std::cout << "index file set error\n";
+    return;
+  }
+
+  if (!WriteExterns)
+    return;
+  std::set<std::string> Externs;
+  collectExterns(Context.getTranslationUnitDecl(), Externs);
+  std::string ExternData;
+  llvm::raw_string_ostream ExternOS(ExternData);
+  for (auto &USR : Externs)
+    ExternOS << USR << "\n";
+  if (!ASTStore::writeAtomically(config.astdir + config.filename + ".extern",
+                                 ExternOS.str()))
+    std::cout << "extern file set error\n";
+}
@@ -1,4 +1,5 @@
 #include "DebugInfo.h"
+#include "MisraTraversal.hpp"
 #include "Reporter.hpp"
 #include "helper/SrcHelper.h"
 #include "plugin_registry.h"
@@ -6,17 +7,20 @@
 
 #include "llvm/ADT/Optional.h"
 #include "llvm/Support/CachePruning.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/raw_ostream.h"
 
 #include "clang/AST/AST.h"
 #include "clang/AST/ASTConsumer.h"
 #include "clang/AST/ASTContext.h"
 #include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/ASTMatchers/ASTMatchFinder.h"
 #include "clang/Driver/Options.h"
 #include "clang/Frontend/ASTConsumers.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendActions.h"
 #include "clang/Frontend/FrontendPluginRegistry.h"
+#include "clang/Frontend/TextDiagnosticPrinter.h"
 #include "clang/Index/USRGeneration.h"
 #include "clang/Lex/Preprocessor.h"
 #include "clang/Sema/Sema.h"
@@ -35,56 +39,274 @@
 
 #include "MisraPlugin.h"
 
+#include <functional>
+
+// Build the lookup tables of every DeclContext up front, DeclContext::lookup
+// would otherwise build them lazily from the worker threads
+static void buildLookupTables(DeclContext *DC) {
+  if (!DC->isTransparentContext())
+    DC->getPrimaryContext()->buildLookup();
+
+  for (auto *D : DC->decls()) {
+    if (auto *CTD = dyn_cast<ClassTemplateDecl>(D))
+      for (auto *Spec : CTD->specializations())
+        buildLookupTables(Spec);
+    if (auto *TD = dyn_cast<TemplateDecl>(D))
+      D = TD->getTemplatedDecl();
+    if (auto *Child = dyn_cast_or_null<DeclContext>(D))
+      buildLookupTables(Child);
+  }
+}
+
 void MisraASTConsumer ::Initialize(ASTContext &Context) {
 
   clang::Preprocessor &pp = CI->getPreprocessor();
   handler = new Misradebug();
   pp.AddPragmaHandler(handler);
 
-  auto Checkers = mgr.getChecker();
+  // CTU imports definitions into the AST while the checkers run, so every
+  // checker has to wait for the whole TU there
+  if (config.stream && config.fused && !config.ctu) {
+    Stream = llvm::make_unique<MisraTraversal>(Context);
+    Stream->prune(config.projectroots);
+  }
 
   for (auto it : config.checkers) {
-    if (Checkers.find(it) == Checkers.end()) {
+    // Only the enabled checkers are created
+    Misrabase *Checker = mgr.getChecker(it);
+    if (!Checker) {
       std::cout << it << " is not exists but we don't expect run this stmt\n";
       continue;
     }
 
-    Checkers[it].first->setCheckerInfo(it, Checkers[it].second);
-    Checkers[it].first->Init(Context, *mbr);
-    Checkers[it].first->regPPCallbacks(*CI);
+    Checker->setCheckerInfo(it, mgr.getDescription(it));
+    Checker->Init(Context, *mbr);
+    Checker->regPPCallbacks(*CI);
+
+    if (Stream && Checker->isDeclLocal() && !Checker->visitSystemHeaders() &&
+        Checker->joinTraversal(*Stream)) {
+      StreamCheckers.push_back(Checker);
+      continue;
+    }
 
     ValidName.push_back(it);
   }
+
+  if (Stream)
+    Stream->begin();
+}
+
+// Template instantiations reach the consumer at the end of the TU, the fused
+// traversal of the TU doesn't visit them either
+static bool isInstantiatedDecl(const Decl *D) {
+  if (auto *FD = dyn_cast<FunctionDecl>(D))
+    return FD->isTemplateInstantiation();
+  if (auto *VD = dyn_cast<VarDecl>(D))
+    return isTemplateInstantiation(VD->getTemplateSpecializationKind());
+  return false;
+}
+
+bool MisraASTConsumer ::HandleTopLevelDecl(DeclGroupRef DG) {
+  if (!Stream || Stream->empty())
+    return true;
+
+  for (auto *Checker : StreamCheckers)
+    Checker->setDebugLoc(handler->getDebugInfo());
+
+  MisraReport::ScopedStat Timer(*mbr, "plugin.stream_traversal");
+  for (auto *D : DG) {
+    if (isInstantiatedDecl(D))
+      continue;
+    Stream->traverse(D);
+  }
+  return true;
+}
+
+static void
+collectDefinitions(const DeclContext *DC,
+                   llvm::StringMap<const FunctionDecl *> &Definitions) {
+  for (const Decl *D : DC->decls()) {
+    if (const auto *SubDC = dyn_cast<DeclContext>(D))
+      collectDefinitions(SubDC, Definitions);
+    const auto *FD = dyn_cast<FunctionDecl>(D);
+    const FunctionDecl *Definition;
+    if (!FD || !FD->hasBody(Definition))
+      continue;
+    Definitions.insert(
+        {cross_tu::CrossTranslationUnitContext::getLookupName(Definition),
+         Definition});
+  }
+}
+
+// CTU parses a text index whole for every TU, a binary one is looked up in
+// place. The definitions of an AST file are collected once, on its first
+// lookup.
+llvm::Expected<const FunctionDecl *>
+MisraASTConsumer::getCrossTUDefinition(const FunctionDecl *FD) {
+  if (!IndexOpened) {
+    IndexOpened = true;
+    Index = CTUIndex::Reader::open(config.indexfile);
+  }
+  if (!Index)
+    return CTU.getCrossTUDefinition(FD, "", config.indexfile);
+
+  std::string LookupName =
+      cross_tu::CrossTranslationUnitContext::getLookupName(FD);
+  StringRef ASTFile = Index->lookup(LookupName);
+  if (ASTFile.empty())
+    return llvm::make_error<cross_tu::IndexError>(
+        cross_tu::index_error_code::missing_definition);
+
+  ExternalAST &AST = ExternalASTs[ASTFile];
+  if (!AST.Unit && !AST.Failed) {
+    IntrusiveRefCntPtr<DiagnosticOptions> DiagOpts = new DiagnosticOptions();
+    TextDiagnosticPrinter *DiagClient =
+        new TextDiagnosticPrinter(llvm::errs(), &*DiagOpts);
+    IntrusiveRefCntPtr<DiagnosticIDs> DiagID(new DiagnosticIDs());
+    IntrusiveRefCntPtr<DiagnosticsEngine> Diags(
+        new DiagnosticsEngine(DiagID, &*DiagOpts, DiagClient));
+    // a compressed AST of the store is loaded from its inflated copy
+    std::string LoadPath = ASTStore::getLoadablePath(ASTFile);
+    if (!LoadPath.empty())
+      AST.Unit = ASTUnit::LoadFromASTFile(
+          LoadPath, CI->getPCHContainerOperations()->getRawReader(),
+          ASTUnit::LoadEverything, Diags, CI->getFileSystemOpts());
+    if (AST.Unit)
+      collectDefinitions(AST.Unit->getASTContext().getTranslationUnitDecl(),
+                         AST.Definitions);
+    else
+      AST.Failed = true;
+  }
+  if (AST.Failed)
+    return llvm::make_error<cross_tu::IndexError>(
+        cross_tu::index_error_code::failed_to_get_external_ast);
+
+  auto It = AST.Definitions.find(LookupName);
+  if (It == AST.Definitions.end())
+    return llvm::make_error<cross_tu::IndexError>(
+        cross_tu::index_error_code::failed_import);
+  return CTU.importDefinition(It->second);
 }
 
-bool MisraASTConsumer ::HandleTopLevelDecl(DeclGroupRef DG) { return true; }
+// Only the callees the checkers ask for are imported, each one once
+const FunctionDecl *MisraASTConsumer::getDefinition(const FunctionDecl *FD) {
+  FD = FD->getCanonicalDecl();
+  auto It = Imported.find(FD);
+  if (It != Imported.end())
+    return It->second;
+
+  MisraReport::ScopedStat Timer(*mbr, "plugin.ctu_import");
+  Timer.nodes = 1;
+  const FunctionDecl *Definition = nullptr;
+  llvm::Expected<const FunctionDecl *> NewFDorError = getCrossTUDefinition(FD);
+  if (auto err = NewFDorError.takeError()) {
+    std::string errstr = "[Index \"" + FD->getNameAsString() + "\" Missing] ";
+    logAllUnhandledErrors(std::move(err), llvm::errs(), errstr);
+  } else {
+    Definition = *NewFDorError;
+  }
+  Imported[FD] = Definition;
+  return Definition;
+}
 
 void MisraASTConsumer::HandleTranslationUnit(ASTContext &Context) {
 
-  if (config.ctu) {
-    for (auto ele : Context.getTranslationUnitDecl()->decls()) {
-      if (auto *FD = dyn_cast<FunctionDecl>(ele)) {
-        // std::cout << "@FunctionDecl:" << FD->getNameAsString() <<
-        // FD->isDefined() << ":" << FD->hasBody() << std::endl;
-        if (!FD->isDefined()) {
-          llvm::Expected<const FunctionDecl *> NewFDorError =
-              CTU.getCrossTUDefinition(FD, "", config.indexfile);
-          if (auto err = NewFDorError.takeError()) {
-            std::string errstr =
-                "[Index \"" + FD->getNameAsString() + "\" Missing] ";
-            logAllUnhandledErrors(std::move(err), llvm::errs(), errstr);
-            continue;
-          }
-        }
-      }
-    }
-    // Context.getTranslationUnitDecl()->dump();
+  if (Stream) {
+    MisraReport::ScopedStat Timer(*mbr, "plugin.stream_traversal");
+    Stream->end();
+    Stream->addStats(*mbr);
   }
 
-  auto Checkers = mgr.getChecker();
+  // Checkers joined to a traversal share one walk of the AST, the others still
+  // run their own traversal. With -jobs=N the joined checkers are spread over
+  // N traversals so they can run in parallel too. Checkers which want system
+  // headers share one more traversal which doesn't prune.
+  unsigned int num_traversals = config.jobs;
+  std::vector<std::unique_ptr<MisraTraversal>> Traversals;
+  for (unsigned int i = 0; i < num_traversals; ++i) {
+    Traversals.push_back(llvm::make_unique<MisraTraversal>(Context));
+    Traversals.back()->prune(config.projectroots);
+  }
+  Traversals.push_back(llvm::make_unique<MisraTraversal>(Context));
+  MisraTraversal &FullTraversal = *Traversals.back();
+
+  // Matcher based checkers share one MatchFinder and one pass over the TU
+  ast_matchers::MatchFinder Finder;
+  unsigned int num_matchers = 0;
+
+  std::vector<std::function<void()>> Jobs;
+  unsigned int num_joined = 0;
+
   for (auto it : ValidName) {
-    std::cout << "Run " << it << std::endl;
-    Checkers[it].first->setDebugLoc(handler->getDebugInfo());
-    Checkers[it].first->runChecker(Context);
+    Misrabase *Checker = mgr.getChecker(it);
+    Checker->setDebugLoc(handler->getDebugInfo());
+    Checker->setCrossTU(config.ctu ? this : nullptr);
+    if (config.fused && Checker->joinMatchFinder(Finder)) {
+      ++num_matchers;
+      continue;
+    }
+    if (config.fused && Checker->visitSystemHeaders() &&
+        Checker->joinTraversal(FullTraversal)) {
+      continue;
+    }
+    if (config.fused && !Checker->visitSystemHeaders() &&
+        Checker->joinTraversal(*Traversals[num_joined % num_traversals])) {
+      ++num_joined;
+      continue;
+    }
+    Jobs.push_back([this, it, Checker, &Context]() {
+      MisraReport::ScopedStat Timer(*mbr, it);
+      Checker->runChecker(Context);
+    });
+  }
+
+  // A fused traversal reports its wall time as a whole, the joined checkers
+  // only get the number of nodes they were handed
+  for (size_t i = 0; i < Traversals.size(); ++i) {
+    if (Traversals[i]->empty())
+      continue;
+    MisraTraversal *T = Traversals[i].get();
+    std::string name = "plugin.fused_traversal.";
+    name += T == &FullTraversal ? "full" : std::to_string(i);
+    Jobs.push_back([this, T, name]() {
+      MisraReport::ScopedStat Timer(*mbr, name);
+      T->run();
+      T->addStats(*mbr);
+    });
+  }
+
+  // Matchers query the SourceManager without ReportHelper::getLock(), the
+  // MatchFinder runs after the jobs, never next to them
+  auto runMatchFinder = [this, &Finder, &Context, num_matchers]() {
+    if (num_matchers == 0)
+      return;
+    MisraReport::ScopedStat Timer(*mbr, "plugin.match_finder");
+    Finder.matchAST(Context);
+  };
+
+  // A CTU import adds decls to the TU, the checkers can't run in parallel
+  if (config.ctu || config.jobs < 2 || Jobs.size() < 2) {
+    for (auto &Job : Jobs)
+      Job();
+    runMatchFinder();
+    return;
+  }
+
+  // The AST is read only from here, but the DeclContext lookup tables are
+  // built on first use. Build them before the threads start. The parent map
+  // is only built under the lock if a checker falls back to it.
+  buildLookupTables(Context.getTranslationUnitDecl());
+
+  mbr->beginJobs(Jobs.size());
+  llvm::ThreadPool Pool(std::min<unsigned int>(config.jobs, Jobs.size()));
+  for (size_t i = 0; i < Jobs.size(); ++i) {
+    Pool.async([this, &Jobs, i]() {
+      mbr->enterJob(i);
+      Jobs[i]();
+      mbr->leaveJob();
+    });
   }
+  Pool.wait();
+  mbr->mergeJobs();
+  runMatchFinder();
 }
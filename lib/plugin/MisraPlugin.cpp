@@ -1,8 +1,19 @@
 ﻿//#define MISRA_DEBUG
 #include "MisraPlugin.h"
+#include "ReportFilters.hpp"
+
+#include "clang/Basic/TargetOptions.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/Compression.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
 
 using json = nlohmann::json;
 
+#include <algorithm>
 #include <ctime>
 #include <fstream>
 #include <functional>
@@ -44,6 +55,98 @@ json loadConfig(std::string configpath) {
   }
 }
 
+static std::string getRealPath(StringRef Path) {
+  SmallString<256> RealPath;
+  if (llvm::sys::fs::real_path(Path, RealPath))
+    return Path.str();
+  return RealPath.str();
+}
+
+// The first TU which reports in a header claims it, the others leave the
+// diagnostics in that header out. The claim is a file in claimdir named by the
+// hash of the path, created exclusively so parallel TUs agree on the owner.
+static SmallString<32> getPathHash(StringRef Path) {
+  llvm::MD5 Hash;
+  Hash.update(Path);
+  llvm::MD5::MD5Result Result;
+  Hash.final(Result);
+  SmallString<32> Name;
+  llvm::MD5::stringifyResult(Result, Name);
+  return Name;
+}
+
+static bool claimFile(const std::string &claimdir, const std::string &file) {
+  SmallString<256> ClaimPath(claimdir);
+  llvm::sys::path::append(ClaimPath, getPathHash(getRealPath(file)));
+
+  int FD;
+  std::error_code EC = llvm::sys::fs::openFileForWrite(
+      ClaimPath, FD, llvm::sys::fs::CD_CreateNew, llvm::sys::fs::F_None);
+  if (EC == std::errc::file_exists)
+    return false;
+  // keep the diagnostics when the claim can't be written at all
+  if (!EC)
+    llvm::sys::Process::SafelyCloseFileDescriptor(FD);
+  return true;
+}
+
+// The AST of a TU in the store is named by the path and the content of its
+// main file and by the language, the target and the include paths. Macros
+// given on the command line are left out: CMake and libtool add
+// -D<target>_EXPORTS and -DPIC to the shared build of a source, and the index
+// of every build has to name the one AST the -emit-ast=only pass writes for
+// the source. The trade-off is that a function defined only under a macro of
+// one build can't be imported when the AST comes from another build.
+static std::string getASTStorePath(CompilerInstance &CI,
+                                   const std::string &aststore, bool compress) {
+  const SourceManager &SM = CI.getSourceManager();
+  const LangOptions &LO = CI.getLangOpts();
+  std::string mainfile = getRealPath(SrcHelper::getMainFileName(CI));
+
+  std::string key = mainfile;
+  key += '\0';
+  key += SM.getBufferData(SM.getMainFileID()).str();
+  key += '\0';
+  for (bool Opt : {bool(LO.C99), bool(LO.C11), bool(LO.C17),
+                   bool(LO.CPlusPlus), bool(LO.CPlusPlus11),
+                   bool(LO.CPlusPlus14), bool(LO.CPlusPlus17),
+                   bool(LO.CPlusPlus2a), bool(LO.GNUMode), bool(LO.Exceptions),
+                   bool(LO.CXXExceptions), bool(LO.RTTI), bool(LO.MicrosoftExt),
+                   bool(LO.CharIsSigned)})
+    key += Opt ? '1' : '0';
+  key += '\0' + CI.getTargetOpts().Triple;
+  key += '\0' + CI.getHeaderSearchOpts().Sysroot;
+  for (auto &Entry : CI.getHeaderSearchOpts().UserEntries)
+    key += '\0' + Entry.Path;
+
+  SmallString<256> ASTPath(aststore);
+  llvm::sys::path::append(ASTPath, llvm::sys::path::stem(mainfile) + "_" +
+                                       getPathHash(key) + ".ast");
+  if (compress)
+    ASTPath += ".z";
+  return ASTPath.str();
+}
+
+// The shard of a file collects the diagnostics shown in it from every TU of a
+// scan. A line goes out in one write to a file opened for appending, so the
+// lines of TUs running in parallel don't interleave.
+static void appendToShard(const std::string &sharddir, const std::string &file,
+                          const std::string &line) {
+  SmallString<256> ShardPath(sharddir);
+  llvm::sys::path::append(ShardPath, llvm::sys::path::stem(file) + "_" +
+                                         getPathHash(file) + ".jsonl");
+
+  int FD;
+  std::error_code EC = llvm::sys::fs::openFileForWrite(
+      ShardPath, FD, llvm::sys::fs::CD_OpenAlways, llvm::sys::fs::F_Append);
+  if (EC) {
+    cout << "Fail to open file: " << ShardPath.str().str() << endl;
+    return;
+  }
+  llvm::raw_fd_ostream OS(FD, true, true);
+  OS << line;
+}
+
 bool MisraPluginAction::ParseArgs(const CompilerInstance &CI,
                                   const vector<string> &args) {
   DEBUG_MSG("Entry Point");
@@ -53,6 +156,12 @@ bool MisraPluginAction::ParseArgs(const CompilerInstance &CI,
   std::string astfilepath;
 
   bool ctu = false;
+  bool fused = true;
+  unsigned int jobs = 1;
+  bool stream = false;
+  bool quiet = false;
+  bool filter = true;
+  std::vector<std::string> projectroots;
 
   for (unsigned i = 0, e = args.size(); i != e; ++i) {
     size_t pos = args[i].find("=", 0);
@@ -98,11 +207,113 @@ bool MisraPluginAction::ParseArgs(const CompilerInstance &CI,
                       reportdir = val;
                       return 0;
                     })
+              .Case("-shard-dir",
+                    [&sharddir = sharddir](std::string val) {
+                      sharddir = val;
+                      return 0;
+                    })
+              .Case("-ast-store",
+                    [&aststore = aststore](std::string val) {
+                      aststore = val;
+                      return 0;
+                    })
+              .Case("-compress-ast",
+                    [&compressast = compressast](std::string val) {
+                      if (val.size() < 1 || val == "true")
+                        compressast = true;
+                      else
+                        compressast = false;
+                      return 0;
+                    })
+              .Case("-claim-dir",
+                    [&claimdir = claimdir](std::string val) {
+                      claimdir = val;
+                      return 0;
+                    })
+              .Case("-format",
+                    [&reportformat = reportformat](std::string val) {
+                      using MisraReport::ReportFormat;
+                      auto format =
+                          llvm::StringSwitch<Optional<ReportFormat>>(val)
+                              .Case("json", ReportFormat::JSON)
+                              .Case("cbor", ReportFormat::CBOR)
+                              .Case("msgpack", ReportFormat::MsgPack)
+                              .Default(None);
+                      if (!format) {
+                        std::cout << "Error Args: -format=" << val << "\n";
+                        return 1;
+                      }
+                      reportformat = *format;
+                      return 0;
+                    })
+              .Case("-emit-ast",
+                    [&emitast = emitast](std::string val) {
+                      auto mode = llvm::StringSwitch<Optional<EmitAST>>(val)
+                                      .Case("", EmitAST::Always)
+                                      .Case("true", EmitAST::Always)
+                                      .Case("false", EmitAST::Never)
+                                      .Case("only", EmitAST::Only)
+                                      .Default(None);
+                      if (!mode) {
+                        std::cout << "Error Args: -emit-ast=" << val << "\n";
+                        return 1;
+                      }
+                      emitast = *mode;
+                      return 0;
+                    })
               .Case("-ctu",
                     [&ctu = ctu](std::string val) {
                       ctu = true;
                       return 0;
                     })
+              .Case("-fused",
+                    [&fused = fused](std::string val) {
+                      if (val.size() < 1 || val == "true")
+                        fused = true;
+                      else
+                        fused = false;
+                      return 0;
+                    })
+              .Case("-jobs",
+                    [&jobs = jobs](std::string val) {
+                      if (StringRef(val).getAsInteger(10, jobs) || jobs < 1) {
+                        std::cout << "Error Args: -jobs=" << val << "\n";
+                        return 1;
+                      }
+                      return 0;
+                    })
+              .Case("-project-root",
+                    [&projectroots = projectroots](std::string val) {
+                      SmallVector<StringRef, 4> roots;
+                      StringRef(val).split(roots, ':', -1, false);
+                      for (auto root : roots)
+                        projectroots.push_back(root.str());
+                      return 0;
+                    })
+              .Case("-stream",
+                    [&stream = stream](std::string val) {
+                      if (val.size() < 1 || val == "true")
+                        stream = true;
+                      else
+                        stream = false;
+                      return 0;
+                    })
+              .Case("-quiet",
+                    [&quiet = quiet](std::string val) {
+                      if (val.size() < 1 || val == "true")
+                        quiet = true;
+                      else
+                        quiet = false;
+                      return 0;
+                    })
+              .Case("-filter",
+                    [&filter = filter](std::string val) {
+                      if (val.size() < 1 || val == "true")
+                        filter = true;
+                      else
+                        filter = false;
+                      return 0;
+                    })
               .Default([](std::string val) {
                 std::cout << "Error Args\n";
                 return 1;
@@ -123,6 +334,12 @@ bool MisraPluginAction::ParseArgs(const CompilerInstance &CI,
   config.indexfile = indexpath;
   config.astdir = astfilepath;
   config.ctu = ctu;
+  config.fused = fused;
+  config.jobs = jobs;
+  config.stream = stream;
+  config.quiet = quiet;
+  config.filter = filter;
+  config.projectroots = projectroots;
 
   return true;
 }
@@ -147,21 +364,31 @@ bool MisraPluginAction::BeginSourceFileAction(CompilerInstance &CI) {
     config.indexfile = config.astdir + config.filename + ".index";
   }
 
+  config.astfile = config.astdir + config.filename + ".ast";
+  if (aststore.size() > 0) {
+    llvm::sys::fs::create_directories(aststore);
+    if (compressast && !llvm::zlib::isAvailable()) {
+      std::cout << "zlib is not available, the AST is not compressed\n";
+      compressast = false;
+    }
+    config.astfile = getASTStorePath(CI, aststore, compressast);
+  }
+
   if (config.checkers.empty()) {
     std::cout << "Disable all checkers exit program\n";
     return false;
   }
 
-  // Then load misra checker we can get all checker name but real object og CSA
-  // checker is not load yet.
-  misra_visitor_register(mgr);
-  misra_ctu_visitor_register(ctu_mgr);
-  //  auto ctu_analysis = misra_register(ctu_mgr, true);
-
-  auto visitors = mgr->getChecker();
+  // Plugin checkers come from the compile-time table, the real objects of CSA
+  // checker are not loaded yet.
 
   // argument list
   if (list) {
+    for (auto &entry : getCheckerTable()) {
+      const CheckerInfo &info = entry.info();
+      std::cout << entry.id << ":" << info.desc << "(" << info.kind << ")"
+                << std::endl;
+    }
     for (auto it : getCheckersList()) {
       std::cout << it.first << ":" << it.second.first << "(" << it.second.second
                 << ")" << std::endl;
@@ -172,6 +399,14 @@ bool MisraPluginAction::BeginSourceFileAction(CompilerInstance &CI) {
     std::vector<std::string> valid_checkers;
 
     for (auto checker_name : config.checkers) {
+      if (const CheckerEntry *entry = findChecker(checker_name)) {
+        const CheckerInfo &info = entry->info();
+        valid_checkers.push_back(checker_name);
+        std::cout << "We Will use:";
+        std::cout << entry->id << ":" << info.desc << "(" << info.kind
+                  << ")\n";
+        continue;
+      }
       auto it = getCheckersList().find(checker_name);
       if (it == getCheckersList().end()) {
         std::cout << "We Can't find checker called " << checker_name
@@ -204,17 +439,35 @@ MisraPluginAction::CreateASTConsumer(CompilerInstance &CI, StringRef file) {
   DEBUG_MSG("Entry Point");
 
   std::vector<std::unique_ptr<ASTConsumer>> Consumers;
-
-  if (!config.ctu) {
-    std::string OutputFile = config.astdir + config.filename + ".ast";
-    std::unique_ptr<raw_pwrite_stream> OS =
-        CI.createOutputFile(OutputFile, true, false, file, "", true);
+  MBR->setSourceManager(CI.getSourceManager());
+  MBR->setQuiet(config.quiet);
+
+  // Another TU only imports from the .ast with CTU checkers, by default it is
+  // written only if they are enabled
+  bool ctu_checkers =
+      std::any_of(config.checkers.begin(), config.checkers.end(),
+                  [this](const std::string &checker) {
+                    return ctu_mgr->hasChecker(checker);
+                  });
+  bool write_ast = emitast == EmitAST::Always || emitast == EmitAST::Only ||
+                   (emitast == EmitAST::Auto && ctu_checkers);
+
+  if (!config.ctu && write_ast) {
+    std::string OutputFile = config.astfile;
+    std::unique_ptr<raw_pwrite_stream> OS;
+    if (ASTStore::isCompressed(OutputFile))
+      OS = llvm::make_unique<ASTStore::CompressedOutputStream>(OutputFile);
+    else
+      OS = CI.createOutputFile(OutputFile, true, false, file, "", true);
 
     if (!OS)
       return nullptr;
 
     std::string Sysroot;
     auto Buffer = std::make_shared<PCHBuffer>();
+    auto PCHStart = std::make_shared<std::chrono::steady_clock::time_point>();
+    Consumers.push_back(
+        llvm::make_unique<StatMarker>(MBR, "plugin.pch", PCHStart, false));
     Consumers.push_back(llvm::make_unique<PCHGenerator>(
         CI.getPreprocessor(), OutputFile, Sysroot, Buffer,
         CI.getFrontendOpts().ModuleFileExtensions, false,
@@ -222,9 +475,17 @@ MisraPluginAction::CreateASTConsumer(CompilerInstance &CI, StringRef file) {
 
     Consumers.push_back(CI.getPCHContainerWriter().CreatePCHContainerGenerator(
         CI, file, OutputFile, std::move(OS), Buffer));
-    Consumers.push_back(llvm::make_unique<IndexConsumer>(&CI, config));
+    Consumers.push_back(
+        llvm::make_unique<StatMarker>(MBR, "plugin.pch", PCHStart, true));
   }
 
+  if (emitast == EmitAST::Only)
+    return llvm::make_unique<MultiplexConsumer>(std::move(Consumers));
+
+  if (!config.ctu)
+    Consumers.push_back(
+        llvm::make_unique<IndexConsumer>(&CI, config, MBR, ctu_checkers));
+
   // Create a AnalysisConsumer
   if (config.checkers.size() < 1 && num_analysis < 1) {
     std::cout << "no Valid Checker\n";
@@ -234,7 +495,7 @@ MisraPluginAction::CreateASTConsumer(CompilerInstance &CI, StringRef file) {
     std::cout << "We have :" << num_analysis << " analyzer checker\n";
     if (config.ctu) {
       mgr = ctu_mgr;
-      std::cout << mgr->getChecker().size() << "and CTU visitor\n";
+      std::cout << mgr->size() << "and CTU visitor\n";
     }
     std::unique_ptr<ento::AnalysisASTConsumer> AnalysisConsumer =
         ento::CreateAnalysisConsumer(CI);
@@ -251,24 +512,63 @@ MisraPluginAction::CreateASTConsumer(CompilerInstance &CI, StringRef file) {
 
 void MisraPluginAction::EndSourceFileAction() {
   DEBUG_MSG("Entry Point");
-  json report_json = MBR->CreateJson();
+
+  // No checker ran
+  if (emitast == EmitAST::Only)
+    return;
+
+  // What the filters of misra-scan drop is never written
+  if (config.filter) {
+    MisraReport::ReportFilterManager Filters(
+        getCompilerInstance().getSourceManager(), config.projectroots);
+    Filters.run(*MBR);
+  }
+
+  // Headers included by many TUs are only reported by the one claiming them
+  if (claimdir.size() > 0) {
+    llvm::sys::fs::create_directories(claimdir);
+    std::string mainfile =
+        getRealPath(SrcHelper::getMainFileName(getCompilerInstance()));
+    MBR->claimFiles([this, &mainfile](const std::string &file) {
+      if (file.empty() || getRealPath(file) == mainfile)
+        return true;
+      return claimFile(claimdir, file);
+    });
+  }
+
+  // The diagnostics go straight to the per file shards, the report of the TU
+  // only keeps its stats
+  if (sharddir.size() > 0) {
+    llvm::sys::fs::create_directories(sharddir);
+    MBR->WriteShards(
+        [this](const std::string &file, const std::string &line) {
+          appendToShard(sharddir, file, line);
+        },
+        reportdir);
+    MBR->clearDiagnostics();
+  }
 
   std::string out_filename;
   if (reportdir.size() < 1) {
     std::cout << "End Analysis (without Report) " << filename << "\n";
     std::cout << "if you want to look json uncomment source code at "
                  "MisraPlugin:251\n";
-    std::cout << std::setw(4) << report_json << std::endl;
+    std::cout << std::setw(4) << MBR->CreateJson() << std::endl;
   } else {
     out_filename = reportdir;
     fstream fp;
-    fp.open(out_filename, ios::out);
+    fp.open(out_filename, ios::out | ios::binary);
     if (!fp) {
       cout << "Fail to open file: " << out_filename << endl;
     }
-    fp << report_json;
+    // Stream the report, the DOM of a noisy TU is several times its size
+    if (reportformat == MisraReport::ReportFormat::JSON)
+      MBR->WriteJson(fp);
+    else
+      MBR->WriteBinary(fp, reportformat);
 
     std::cout << "End Analysis " << filename << "\n";
   }
-  // free
+  // free the diagnostics of this TU, the consumers may still add stats
+  MBR->clear();
 }
@@ -0,0 +1,132 @@
+#include "MisraTraversal.hpp"
+#include "helper/ReportHelper.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+
+#include <mutex>
+
+static std::string getRealPath(StringRef Path) {
+  SmallString<256> RealPath;
+  if (llvm::sys::fs::real_path(Path, RealPath))
+    return Path.str();
+  return RealPath.str();
+}
+
+SourceFilter::SourceFilter(const SourceManager &SM,
+                           const std::vector<std::string> &ProjectRoots)
+    : SM(SM) {
+  for (auto &Root : ProjectRoots) {
+    std::string RealRoot = getRealPath(Root);
+    while (RealRoot.size() > 1 && RealRoot.back() == '/')
+      RealRoot.pop_back();
+    Roots.push_back(RealRoot);
+  }
+}
+
+bool SourceFilter::isExcludedFile(FileID FID, SourceLocation Loc) {
+  if (FID == SM.getMainFileID())
+    return false;
+  if (SM.isInSystemHeader(Loc))
+    return true;
+  if (Roots.empty())
+    return false;
+
+  const FileEntry *FE = SM.getFileEntryForID(FID);
+  if (!FE)
+    return false;
+  std::string Path = FE->tryGetRealPathName();
+  if (Path.empty())
+    Path = getRealPath(FE->getName());
+
+  for (auto &Root : Roots) {
+    if (StringRef(Path).startswith(Root) &&
+        (Path.size() == Root.size() || Path[Root.size()] == '/' ||
+         Root == "/"))
+      return false;
+  }
+  return true;
+}
+
+bool SourceFilter::isExcluded(const Decl *D) {
+  return isExcluded(D->getLocation());
+}
+
+bool SourceFilter::isExcluded(SourceLocation Loc) {
+  if (Loc.isInvalid())
+    return false;
+
+  // Parallel traversals each own a filter but share the SourceManager
+  std::lock_guard<std::mutex> Guard(ReportHelper::getLock());
+  Loc = SM.getExpansionLoc(Loc);
+  FileID FID = SM.getFileID(Loc);
+  auto It = Excluded.find(FID);
+  if (It != Excluded.end())
+    return It->second;
+  return Excluded[FID] = isExcludedFile(FID, Loc);
+}
+
+void MisraTraversal::run() {
+  begin();
+  TraverseDecl(Context.getTranslationUnitDecl());
+  end();
+}
+
+bool MisraTraversal::TraverseDecl(Decl *D) {
+  // Only file level decls are filtered, the rest follow their parent
+  if (D && Filter && D->getDeclContext() &&
+      D->getDeclContext()->getRedeclContext()->isFileContext() &&
+      Filter->isExcluded(D))
+    return true;
+
+  // An aborted walk skips dataTraverseStmtPost, restore the depth on the way out
+  size_t Depth = Ancestors.size();
+  Ancestors.push(nullptr);
+  bool Ret = RecursiveASTVisitor<MisraTraversal>::TraverseDecl(D);
+  Ancestors.truncate(Depth);
+  return Ret;
+}
+
+void MisraTraversal::addStats(MisraReport::MisraBugReport &MBR) const {
+  for (auto &FV : Visitors)
+    MBR.addStat(FV->name, 0, FV->visits);
+}
+
+void MisraTraversal::begin() {
+  for (auto &FV : Visitors)
+    FV->handlePre();
+}
+
+void MisraTraversal::traverse(Decl *D) {
+  if (Live > 0)
+    TraverseDecl(D);
+}
+
+void MisraTraversal::end() {
+  for (auto &FV : Visitors)
+    FV->handlePost();
+}
+
+bool MisraTraversal::VisitDecl(Decl *D) {
+  return dispatch(DeclTable[D->getKind()],
+                  [D](FusedVisitor &FV) { return FV.visitDecl(D); });
+}
+
+bool MisraTraversal::VisitStmt(Stmt *S) {
+  auto F = [S](FusedVisitor &FV) { return FV.visitStmt(S); };
+  if (auto *BinOp = dyn_cast<BinaryOperator>(S))
+    return dispatch(BinOpTable[BinOp->getOpcode()], F);
+  if (auto *UnOp = dyn_cast<UnaryOperator>(S))
+    return dispatch(UnOpTable[UnOp->getOpcode()], F);
+  return dispatch(StmtTable[S->getStmtClass()], F);
+}
+
+bool MisraTraversal::VisitType(Type *T) {
+  return dispatch(TypeTable[T->getTypeClass()],
+                  [T](FusedVisitor &FV) { return FV.visitType(T); });
+}
+
+bool MisraTraversal::VisitTypeLoc(TypeLoc TL) {
+  return dispatch(TypeLocTable[TL.getTypeLocClass()],
+                  [TL](FusedVisitor &FV) { return FV.visitTypeLoc(TL); });
+}
@@ -0,0 +1,87 @@
+#include "ReportFilters.hpp"
+
+#include "llvm/Support/FileSystem.h"
+
+#include <set>
+#include <unordered_map>
+
+using namespace MisraReport;
+
+// "Misra CPP 2008  Rule 16-0-7" -> "16-0-7", the rule lists of misra-scan
+// match the last word of the type
+static std::string getRuleNumber(const std::string &type) {
+  size_t pos = type.rfind(' ');
+  return pos == std::string::npos ? type : type.substr(pos + 1);
+}
+
+std::vector<bool>
+FileMissingFilter::generateFilterMask(const std::vector<Diag> &diagnostics,
+                                      const FileTable &Files) {
+  std::unordered_map<unsigned, bool> records;
+  std::vector<bool> mask;
+  for (auto &D : diagnostics) {
+    unsigned file = D.path.empty() ? 0 : MisraBugReport::getMainFile(D);
+    auto it = records.find(file);
+    if (it == records.end()) {
+      bool alive = llvm::sys::fs::exists(Files.name(file));
+      it = records.emplace(file, alive).first;
+    }
+    mask.push_back(it->second);
+  }
+  return mask;
+}
+
+std::vector<bool>
+MisraCCategoryFilter::generateFilterMask(const std::vector<Diag> &diagnostics,
+                                         const FileTable &Files) {
+  std::vector<bool> mask;
+  for (auto &D : diagnostics)
+    mask.push_back(D.category == "MisraC");
+  return mask;
+}
+
+std::vector<bool>
+UseSystemMacroFilter::generateFilterMask(const std::vector<Diag> &diagnostics,
+                                         const FileTable &Files) {
+  static const std::set<std::string> Rules = {
+      "7.4",   "9.1",   "9.3",   "10.1",  "10.2",  "10.3", "10.4", "10.5",
+      "11.1",  "11.2",  "11.3",  "11.4",  "11.5",  "11.6", "11.7", "11.8",
+      "12.2",  "12.3",  "12.4",  "12.5",  "13.4",  "15.1", "15.2", "15.3",
+      "15.4",  "15.5",  "15.6",  "15.7",  "16.2",  "16.3", "16.4", "16.5",
+      "16.6",  "16.7",  "17.1",  "17.3",  "18.4",  "19.2", "21.1", "21.2",
+      "21.3",  "21.4",  "21.5",  "21.6",  "21.7",  "21.8", "21.9", "21.10",
+      "21.11", "21.12"};
+
+  std::vector<bool> mask;
+  for (auto &D : diagnostics) {
+    bool keep = true;
+    if (Rules.count(getRuleNumber(D.type))) {
+      for (auto &I : D.path) {
+        SourceLocation Loc = I.getrawloc();
+        if (I.getkind() == "macro" && Loc.isValid() &&
+            Filter.isExcluded(Loc)) {
+          keep = false;
+          break;
+        }
+      }
+    }
+    mask.push_back(keep);
+  }
+  return mask;
+}
+
+ReportFilterManager::ReportFilterManager(
+    const SourceManager &SM, const std::vector<std::string> &ProjectRoots) {
+  Filters.emplace_back(new FileMissingFilter());
+  Filters.emplace_back(new MisraCCategoryFilter());
+  Filters.emplace_back(new UseSystemMacroFilter(SM, ProjectRoots));
+}
+
+void ReportFilterManager::run(MisraBugReport &MBR) {
+  for (auto &F : Filters)
+    MBR.filterDiagnostics(
+        [&F](const std::vector<Diag> &diagnostics, const FileTable &Files) {
+          return F->generateFilterMask(diagnostics, Files);
+        },
+        std::string("plugin.filter.") + F->name());
+}
@@ -19,7 +19,10 @@ class Rule_10_1_2 : public RecursiveASTVisitor<Rule_10_1_2>,
 public:
   using MisraVisitor::MisraVisitor;
   bool VisitCXXRecordDecl(CXXRecordDecl *RD);
-  bool TraverseTranslationUnitDecl(TranslationUnitDecl *TUD);
+  void handlePost() override;
+  // A diamond may be completed through base classes of system headers and of
+  // files outside the project roots
+  bool shouldVisitSystemHeaders() override { return true; }
 
 private:
   vector<CXXRecordDecl *> record_list; // For highest hierarchy base class
@@ -27,13 +30,8 @@ private:
   vector<CXXRecordDecl *> temp_list;
 };
 
-bool Rule_10_1_2::TraverseTranslationUnitDecl(TranslationUnitDecl *TUD) {
-  /*for (auto &&i : TUD->decls()) {
-    if (auto *t = dyn_cast<CXXRecordDecl>(i))
-      Rule_10_1_2::CheckCXXRecordDecl(t);
-  }*/
-  RecursiveASTVisitor<Rule_10_1_2>::TraverseTranslationUnitDecl(TUD);
-  // cout << "After traverse" << endl;
+// Report after the whole TU is visited, a later record may complete the diamond
+void Rule_10_1_2::handlePost() {
   for (auto k = error_list.begin(); k != error_list.end(); ++k) {
     SourceRange sr((*k)->getLocation());
     SimpleBugReport(&sr, err_kind, err_desc);
@@ -41,7 +39,6 @@ bool Rule_10_1_2::TraverseTranslationUnitDecl(TranslationUnitDecl *TUD) {
   record_list.clear();
   error_list.clear();
   temp_list.clear();
-  return true;
 }
 
 bool Rule_10_1_2::VisitCXXRecordDecl(CXXRecordDecl *RD) {
@@ -21,7 +21,7 @@ public:
 };
 
 bool Rule_14_8_2::VisitCallExpr(CallExpr *CE) {
-  if (sm->isInSystemHeader(CE->getExprLoc()))
+  if (isInSystemHeader(CE->getExprLoc()))
     return true;
   if (auto OCE = dyn_cast_or_null<CXXOperatorCallExpr>(CE)) {
     // operator overloading naturally with function template and function
@@ -48,7 +48,7 @@ bool Rule_14_8_2::VisitCallExpr(CallExpr *CE) {
       for (NamedDecl *ND : LookupParent->lookup(DN)) {
         if (ND == nullptr)
           continue;
-        if (sm->isInSystemHeader(ND->getLocation())) {
+        if (isInSystemHeader(ND->getLocation())) {
           return true;
         }
         hasNormalFunc |= isa<FunctionDecl>(ND);
@@ -65,7 +65,7 @@ bool Rule_14_8_2::VisitCallExpr(CallExpr *CE) {
     for (NamedDecl *ND : ULE->decls()) {
       if (ND == nullptr)
         continue;
-      if (sm->isInSystemHeader(ND->getLocation())) {
+      if (isInSystemHeader(ND->getLocation())) {
         return true;
       }
       hasNormalFunc |= isa<FunctionDecl>(ND);
@@ -50,4 +50,4 @@ bool Rule_15_3_2::VisitCXXTryStmt(CXXTryStmt *TS) {
 }
 
 
-REGISTER_VISITOR_CHECKER(Rule_15_3_2, "MisraCPP.15_3_2", rule_desc)
+REGISTER_LOCAL_VISITOR_CHECKER(Rule_15_3_2, "MisraCPP.15_3_2", rule_desc)
@@ -31,4 +31,4 @@ bool Rule_3_9_3::VisitCastExpr(CastExpr *rce){
   return true;
 }
 
-REGISTER_VISITOR_CHECKER(Rule_3_9_3, "MisraCPP.3_9_3", rule_desc)
+REGISTER_LOCAL_VISITOR_CHECKER(Rule_3_9_3, "MisraCPP.3_9_3", rule_desc)
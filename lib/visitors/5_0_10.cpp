@@ -33,7 +33,7 @@ private:
 };
 
 bool Rule_5_0_10::VisitUnaryOperator(UnaryOperator *UO) {
-  if (sm->isInSystemHeader(UO->getExprLoc()))
+  if (isInSystemHeader(UO->getExprLoc()))
     return true;
 
   if (UO->getOpcode() == UO_Not) {
@@ -45,7 +45,7 @@ bool Rule_5_0_10::VisitUnaryOperator(UnaryOperator *UO) {
 }
 
 bool Rule_5_0_10::VisitBinaryOperator(BinaryOperator *BO) {
-  if (sm->isInSystemHeader(BO->getExprLoc())) {
+  if (isInSystemHeader(BO->getExprLoc())) {
     return true;
   }
 
@@ -102,7 +102,7 @@ bool Rule_5_0_10::isSmallIntegerType(const Expr *expr) {
   if (!Type->isIntegerType())
     return false;
 
-  auto Width = Context->getTypeInfo(Type).Width;
+  auto Width = getTypeInfo(Type).Width;
   auto Signed = Type->isSignedIntegerType();
 
   return (Signed == false) && (Width == 8 || Width == 16);
@@ -117,28 +117,13 @@ bool Rule_5_0_10::isTemplateType(const Expr *expr) {
 }
 
 bool Rule_5_0_10::sameTypeWidth(const Expr *A, const Expr *B) {
-  auto WidthA = Context->getTypeInfo(A->getType()).Width;
-  auto WidthB = Context->getTypeInfo(B->getType()).Width;
+  auto WidthA = getTypeInfo(A->getType()).Width;
+  auto WidthB = getTypeInfo(B->getType()).Width;
   return WidthA == WidthB;
 }
 
 const ExplicitCastExpr *Rule_5_0_10::findParentECE(const Stmt *cur) {
-  while (true) {
-    const auto &parents = Context->getParents(*cur);
-    if (parents.empty())
-      break;
-
-    cur = parents[0].get<Stmt>();
-    if (cur) {
-      if (isa<ImplicitCastExpr>(cur)) {
-        continue;
-      } else if (auto *ECE = dyn_cast<ExplicitCastExpr>(cur)) {
-        return ECE;
-      }
-    }
-    break;
-  }
-  return nullptr;
+  return findAncestor<ExplicitCastExpr, ImplicitCastExpr>(cur);
 }
 
-REGISTER_VISITOR_CHECKER(Rule_5_0_10, "MisraCPP.5_0_10", rule_desc)
+REGISTER_LOCAL_VISITOR_CHECKER(Rule_5_0_10, "MisraCPP.5_0_10", rule_desc)
@@ -0,0 +1,30 @@
+#include "clang/ASTMatchers/ASTMatchFinder.h"
+#include "clang/ASTMatchers/ASTMatchers.h"
+
+#include "MisraVisitor.hpp"
+
+using namespace clang;
+using namespace clang::ast_matchers;
+
+static char err_kind[] = "Misra CPP Rule 7-3-4";
+static char rule_desc[] = "using-directives shall not be used";
+
+class Rule_7_3_4 : public MatchFinder::MatchCallback, public MisraVisitor {
+public:
+  using MisraVisitor::MisraVisitor;
+  void registerMatchers(MatchFinder &Finder);
+  void run(const MatchFinder::MatchResult &Result) override;
+};
+
+void Rule_7_3_4::registerMatchers(MatchFinder &Finder) {
+  Finder.addMatcher(
+      usingDirectiveDecl(unless(isExpansionInSystemHeader())).bind("using"),
+      this);
+}
+
+void Rule_7_3_4::run(const MatchFinder::MatchResult &Result) {
+  if (auto *UDD = Result.Nodes.getNodeAs<UsingDirectiveDecl>("using"))
+    SimpleBugReport(UDD, err_kind, rule_desc);
+}
+
+REGISTER_MATCHER_CHECKER(Rule_7_3_4, "MisraCPP.7_3_4", rule_desc)
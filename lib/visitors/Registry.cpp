@@ -0,0 +1,43 @@
+#include "plugin_registry.h"
+
+#include <algorithm>
+
+#define MISRA_CHECKER(rule)                                                    \
+  Misrabase *misra_create_Rule_##rule();                                       \
+  const CheckerInfo &misra_info_Rule_##rule();
+#include "Checkers.def"
+#undef MISRA_CHECKER
+
+static constexpr CheckerEntry Table[] = {
+#define MISRA_CHECKER(rule)                                                    \
+  {"MisraCPP." #rule, &misra_create_Rule_##rule, &misra_info_Rule_##rule},
+#include "Checkers.def"
+#undef MISRA_CHECKER
+};
+
+static constexpr int compareID(const char *a, const char *b) {
+  return *a != *b ? (*a < *b ? -1 : 1) : (*a ? compareID(a + 1, b + 1) : 0);
+}
+
+static constexpr bool isSorted(const CheckerEntry *first, size_t n) {
+  return n < 2 ? true
+               : compareID(first[0].id, first[1].id) < 0 &&
+                     isSorted(first + 1, n - 1);
+}
+
+// CMake sorts the rule IDs as strings, findChecker relies on it
+static_assert(isSorted(Table, sizeof(Table) / sizeof(Table[0])),
+              "Checkers.def must be sorted by rule ID");
+
+const CheckerEntry *findChecker(StringRef id) {
+  auto *end = std::end(Table);
+  auto *it = std::lower_bound(std::begin(Table), end, id,
+                              [](const CheckerEntry &entry, StringRef id) {
+                                return StringRef(entry.id) < id;
+                              });
+  if (it == end || id != it->id)
+    return nullptr;
+  return it;
+}
+
+ArrayRef<CheckerEntry> getCheckerTable() { return Table; }
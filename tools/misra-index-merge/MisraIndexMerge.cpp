@@ -0,0 +1,83 @@
+/* misra-index-merge merges the CTU indexes of the TUs linked into a target
+ * into one binary index, see CTUIndex.hpp. A USR defined in several inputs,
+ * an inline function of a header for one, keeps the definition of the first
+ * input naming it. The inputs are binary indexes or text indexes of the
+ * former "<USR> <AST path>" format.
+ */
+#include "CTUIndex.hpp"
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+static cl::list<std::string> Inputs(cl::Positional, cl::OneOrMore,
+                                    cl::desc("<index>..."));
+
+static cl::opt<std::string> Output("o", cl::Required,
+                                   cl::desc("The merged index"),
+                                   cl::value_desc("path"));
+
+static bool addTextIndex(CTUIndex::Builder &Index, StringRef Path,
+                         StringRef Buffer, size_t &Duplicates) {
+  SmallVector<StringRef, 64> Lines;
+  Buffer.split(Lines, '\n', -1, false);
+  for (StringRef Line : Lines) {
+    Line = Line.rtrim("\r");
+    std::pair<StringRef, StringRef> Fields = Line.split(' ');
+    if (Fields.first.empty() || Fields.second.empty()) {
+      errs() << "misra-index-merge: " << Path << ": invalid line \"" << Line
+             << "\"\n";
+      return false;
+    }
+    if (!Index.add(Fields.first, Fields.second))
+      ++Duplicates;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  cl::ParseCommandLineOptions(argc, argv, "Merge the CTU indexes of TUs\n");
+
+  CTUIndex::Builder Index;
+  size_t Duplicates = 0;
+  for (auto &Path : Inputs) {
+    if (auto Reader = CTUIndex::Reader::open(Path)) {
+      Reader->forEach([&](StringRef USR, StringRef ASTFile) {
+        if (!Index.add(USR, ASTFile))
+          ++Duplicates;
+      });
+      continue;
+    }
+
+    auto Buffer = MemoryBuffer::getFile(Path, -1, false);
+    if (!Buffer) {
+      errs() << "misra-index-merge: " << Path << ": "
+             << Buffer.getError().message() << "\n";
+      return 1;
+    }
+    if (CTUIndex::isBinaryIndex((*Buffer)->getBuffer())) {
+      errs() << "misra-index-merge: " << Path << ": corrupt index\n";
+      return 1;
+    }
+    if (!addTextIndex(Index, Path, (*Buffer)->getBuffer(), Duplicates))
+      return 1;
+  }
+
+  std::error_code EC;
+  raw_fd_ostream OS(Output, EC, sys::fs::F_None);
+  if (EC) {
+    errs() << "misra-index-merge: " << Output << ": " << EC.message() << "\n";
+    return 1;
+  }
+  Index.write(OS);
+
+  outs() << "misra-index-merge: " << Inputs.size() << " indexes, "
+         << Index.size() << " functions, " << Duplicates << " duplicates\n";
+  return 0;
+}
@@ -0,0 +1,458 @@
+/* misra-merge reads the per TU reports of a misra-scan run and merges them the
+ * way JSONReportHelper does: it resolves the location of every diagnostic,
+ * drops duplicates and diagnostics outside the source dir, sorts them by file,
+ * line and column and writes them into one report per source file. The
+ * reports are parsed in parallel, each one is sorted on its own and the sorted
+ * runs are merged, ties keep the order of the report files.
+ *
+ * The plugin may also have appended the diagnostics of the TUs to the files of
+ * <report dir>/shards, one report per line. Those lines are merged as if each
+ * one was a report of its own.
+ *
+ * The summary goes to <report dir>/merged-index.json: the shards in order with
+ * the report each of their diagnostics came from, and the stats of all TUs.
+ */
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <map>
+#include <queue>
+#include <set>
+#include <string>
+#include <tuple>
+#include <unordered_set>
+#include <vector>
+
+using json = nlohmann::json;
+using namespace llvm;
+
+static cl::opt<std::string> ReportDir(cl::Positional, cl::Required,
+                                      cl::desc("<report dir>"));
+
+static cl::opt<std::string>
+    SrcDir("src-dir", cl::desc("Drop the diagnostics outside this directory"));
+
+static cl::opt<unsigned>
+    Jobs("jobs", cl::init(0),
+         cl::desc("Reports parsed in parallel, 0 for one per core"));
+
+static cl::opt<bool> KeepReports("keep-reports", cl::init(false),
+                                 cl::desc("Keep the per TU reports"));
+
+static const char *IndexName = "merged-index.json";
+static const char *ShardDirName = "shards";
+
+// A diagnostic as misra-scan keeps it, only the fields of PathDiagnostic
+struct Diagnostic {
+  json Diag;
+  std::string File; // location of the deepest event
+  int64_t Line = 0;
+  int64_t Column = 0;
+  std::string Key; // compact dump of Diag, the same for duplicates
+};
+
+struct Report {
+  std::string Path;
+  std::string Origin; // the TU report the diagnostics belong to
+  StringRef Line;     // the report when it is a line of a shard
+  std::string ClangVersion;
+  json Stats;
+  std::vector<Diagnostic> Diags;
+  bool Failed = false;
+};
+
+static json getFile(const json &Loc, const json &Files) {
+  auto It = Loc.find("file");
+  if (It == Loc.end())
+    return nullptr;
+  // locations refer to files by their index in the "files" table
+  if (It->is_number_unsigned() && Files.is_array() &&
+      It->get<size_t>() < Files.size())
+    return Files[It->get<size_t>()];
+  return *It;
+}
+
+static json normalizeLocation(const json &Loc, const json &Files) {
+  if (!Loc.is_object())
+    return {{"file", nullptr}, {"line", nullptr}, {"column", nullptr}};
+  return {{"file", getFile(Loc, Files)},
+          {"line", Loc.value("line", json())},
+          {"column", Loc.value("column", json())}};
+}
+
+static json normalizePiece(const json &Piece, const json &Files) {
+  json Ranges = json::array();
+  auto It = Piece.find("ranges");
+  if (It != Piece.end() && It->is_array())
+    for (auto &Loc : *It)
+      Ranges.push_back(normalizeLocation(Loc, Files));
+  return {{"depth", Piece.value("depth", 0)},
+          {"kind", Piece.value("kind", json())},
+          {"message", Piece.value("message", json())},
+          {"extended_message", Piece.value("extended_message", json())},
+          {"location", normalizeLocation(Piece.value("location", json()), Files)},
+          {"ranges", Ranges}};
+}
+
+static std::string getAbsolutePath(StringRef Path) {
+  SmallString<256> Abs(Path);
+  sys::fs::make_absolute(Abs);
+  sys::path::remove_dots(Abs, true);
+  return Abs.str();
+}
+
+static bool isInside(const std::string &File, const std::string &Dir) {
+  if (Dir.empty())
+    return true;
+  std::string Abs = getAbsolutePath(File);
+  return StringRef(Abs).startswith(Dir) &&
+         (Abs.size() == Dir.size() || Abs[Dir.size()] == '/' || Dir == "/");
+}
+
+static json parseReport(const std::string &Path, StringRef Buffer) {
+  const char *Begin = Buffer.begin(), *End = Buffer.end();
+  StringRef Ext = sys::path::extension(Path);
+  if (Ext == ".cbor")
+    return json::from_cbor(Begin, End);
+  if (Ext == ".msgpack")
+    return json::from_msgpack(Begin, End);
+  return json::parse(Begin, End);
+}
+
+static void readReport(Report &R, const std::string &Source) {
+  json Content;
+  try {
+    if (!R.Line.empty()) {
+      Content = json::parse(R.Line.begin(), R.Line.end());
+      R.Origin = Content.value("report", R.Path);
+    } else {
+      auto Buffer = MemoryBuffer::getFile(R.Path, -1, false);
+      if (!Buffer) {
+        errs() << "misra-merge: " << R.Path << ": "
+               << Buffer.getError().message() << "\n";
+        R.Failed = true;
+        return;
+      }
+      Content = parseReport(R.Path, (*Buffer)->getBuffer());
+      R.Origin = R.Path;
+    }
+  } catch (json::exception &E) {
+    errs() << "misra-merge: " << R.Path << ": " << E.what() << "\n";
+    R.Failed = true;
+    return;
+  }
+
+  R.ClangVersion = Content.value("clang_version", "");
+  R.Stats = Content.value("stats", json::object());
+  const json &Files = Content["files"];
+  const json &Diags = Content["diagnostics"];
+  if (!Diags.is_array())
+    return;
+  for (auto &Diag : Diags) {
+    auto Path = Diag.find("path");
+    if (Path == Diag.end() || !Path->is_array() || Path->empty())
+      continue;
+
+    json Pieces = json::array();
+    for (auto &Piece : *Path)
+      Pieces.push_back(normalizePiece(Piece, Files));
+
+    // misra-scan shows the deepest event of the path
+    const json *Final = &Pieces.front();
+    int64_t Depth = -1;
+    for (auto &Piece : Pieces) {
+      if (Piece["kind"] == "event" && Piece["depth"].is_number() &&
+          Piece["depth"].get<int64_t>() > Depth) {
+        Depth = Piece["depth"].get<int64_t>();
+        Final = &Piece;
+      }
+    }
+
+    Diagnostic D;
+    json Loc = (*Final)["location"];
+    D.File = Loc["file"].is_string() ? Loc["file"].get<std::string>() : "";
+    D.Line = Loc["line"].is_number() ? Loc["line"].get<int64_t>() : 0;
+    D.Column = Loc["column"].is_number() ? Loc["column"].get<int64_t>() : 0;
+    if (!isInside(D.File, Source))
+      continue;
+
+    D.Diag = {{"category", Diag.value("category", json())},
+              {"type", Diag.value("type", json())},
+              {"description", Diag.value("description", json())},
+              {"check_name", Diag.value("check_name", json())},
+              {"location", Loc},
+              {"path", std::move(Pieces)}};
+    D.Key = D.Diag.dump();
+    R.Diags.push_back(std::move(D));
+  }
+
+  std::stable_sort(R.Diags.begin(), R.Diags.end(),
+                   [](const Diagnostic &A, const Diagnostic &B) {
+                     return std::tie(A.File, A.Line, A.Column) <
+                            std::tie(B.File, B.Line, B.Column);
+                   });
+}
+
+// The shards are read by python, write them as its json.dumps does with the
+// fields of the MisraNamedTuples in order. Like its default ensure_ascii,
+// non-ASCII characters are escaped as \uXXXX.
+static std::string dumps(const json &J) { return J.dump(-1, ' ', true); }
+
+static void writeLocation(raw_ostream &OS, const json &Loc) {
+  OS << "{\"file\": " << dumps(Loc["file"]) << ", \"line\": "
+     << dumps(Loc["line"]) << ", \"column\": " << dumps(Loc["column"]) << "}";
+}
+
+static void writeDiagnostic(raw_ostream &OS, const json &Diag) {
+  OS << "{\"category\": " << dumps(Diag["category"])
+     << ", \"type\": " << dumps(Diag["type"])
+     << ", \"description\": " << dumps(Diag["description"])
+     << ", \"check_name\": " << dumps(Diag["check_name"]) << ", \"location\": ";
+  writeLocation(OS, Diag["location"]);
+  OS << ", \"path\": [";
+  bool FirstPiece = true;
+  for (auto &Piece : Diag["path"]) {
+    OS << (FirstPiece ? "" : ", ") << "{\"depth\": " << dumps(Piece["depth"])
+       << ", \"kind\": " << dumps(Piece["kind"])
+       << ", \"message\": " << dumps(Piece["message"])
+       << ", \"extended_message\": " << dumps(Piece["extended_message"])
+       << ", \"location\": ";
+    writeLocation(OS, Piece["location"]);
+    OS << ", \"ranges\": [";
+    bool FirstRange = true;
+    for (auto &Range : Piece["ranges"]) {
+      OS << (FirstRange ? "" : ", ");
+      writeLocation(OS, Range);
+      FirstRange = false;
+    }
+    OS << "]}";
+    FirstPiece = false;
+  }
+  OS << "]}";
+}
+
+struct Shard {
+  std::string Name;
+  std::string Source;
+  std::vector<const Diagnostic *> Diags;
+  std::vector<const Report *> Origins;
+};
+
+static bool writeShard(const Shard &S, const std::string &ClangVersion) {
+  SmallString<256> Path(ReportDir);
+  sys::path::append(Path, S.Name);
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::F_None);
+  if (EC) {
+    errs() << "misra-merge: " << Path << ": " << EC.message() << "\n";
+    return false;
+  }
+  OS << "{\"clang_version\": " << dumps(json(ClangVersion))
+     << ", \"diagnostics\": [";
+  for (size_t i = 0; i < S.Diags.size(); ++i) {
+    if (i)
+      OS << ", ";
+    writeDiagnostic(OS, S.Diags[i]->Diag);
+  }
+  OS << "]}";
+  return true;
+}
+
+static std::vector<std::string> findReports(StringRef Dir,
+                                            ArrayRef<StringRef> Exts) {
+  std::vector<std::string> Paths;
+  std::error_code EC;
+  for (sys::fs::directory_iterator It(Dir, EC), End; It != End && !EC;
+       It.increment(EC)) {
+    StringRef Name = sys::path::filename(It->path());
+    StringRef Ext = sys::path::extension(Name);
+    if (Name == IndexName || !sys::path::stem(Name).contains('_') ||
+        std::find(Exts.begin(), Exts.end(), Ext) == Exts.end())
+      continue;
+    Paths.push_back(It->path());
+  }
+  // the order of the reports breaks ties, keep it independent of the
+  // file system
+  std::sort(Paths.begin(), Paths.end());
+  return Paths;
+}
+
+int main(int argc, char **argv) {
+  cl::ParseCommandLineOptions(argc, argv, "Merge the reports of misra-scan\n");
+
+  std::string Source = SrcDir.empty() ? "" : getAbsolutePath(SrcDir);
+  std::vector<std::string> Paths =
+      findReports(ReportDir, {".json", ".cbor", ".msgpack"});
+  std::vector<Report> Reports(Paths.size());
+  for (size_t i = 0; i < Paths.size(); ++i)
+    Reports[i].Path = Paths[i];
+
+  // every line of a shard is parsed on its own, the buffers outlive the pool
+  SmallString<256> ShardDir(ReportDir);
+  sys::path::append(ShardDir, ShardDirName);
+  std::vector<std::string> ShardPaths = findReports(ShardDir, {".jsonl"});
+  std::vector<std::unique_ptr<MemoryBuffer>> ShardBuffers;
+  for (auto &Path : ShardPaths) {
+    auto Buffer = MemoryBuffer::getFile(Path, -1, false);
+    if (!Buffer) {
+      errs() << "misra-merge: " << Path << ": " << Buffer.getError().message()
+             << "\n";
+      continue;
+    }
+    SmallVector<StringRef, 16> Lines;
+    (*Buffer)->getBuffer().split(Lines, '\n', -1, false);
+    for (StringRef Line : Lines) {
+      Reports.push_back(Report());
+      Reports.back().Path = Path;
+      Reports.back().Line = Line;
+    }
+    ShardBuffers.push_back(std::move(*Buffer));
+  }
+
+  {
+    ThreadPool Pool(Jobs ? Jobs : llvm::hardware_concurrency());
+    for (size_t i = 0; i < Reports.size(); ++i)
+      Pool.async([&Reports, &Source, i]() { readReport(Reports[i], Source); });
+    Pool.wait();
+  }
+
+  // Sum up the stats of every TU, empty reports included
+  json Stats = json::object();
+  std::string ClangVersion;
+  for (auto &R : Reports) {
+    if (R.Failed)
+      continue;
+    if (!R.ClangVersion.empty())
+      ClangVersion = R.ClangVersion;
+    for (auto It = R.Stats.begin(); It != R.Stats.end(); ++It) {
+      json &Total = Stats[It.key()];
+      if (Total.is_null())
+        Total = {{"wall_time", 0.0},
+                 {"nodes", 0},
+                 {"diagnostics", 0},
+                 {"translation_units", 0}};
+      Total["wall_time"] =
+          Total["wall_time"].get<double>() + It->value("wall_time", 0.0);
+      Total["nodes"] = Total["nodes"].get<uint64_t>() +
+                       It->value("nodes", static_cast<uint64_t>(0));
+      Total["diagnostics"] =
+          Total["diagnostics"].get<uint64_t>() +
+          It->value("diagnostics", static_cast<uint64_t>(0));
+      Total["translation_units"] =
+          Total["translation_units"].get<uint64_t>() + 1;
+    }
+  }
+
+  // k-way merge of the sorted reports, a duplicate keeps its first place
+  typedef std::tuple<const std::string *, int64_t, int64_t, size_t, size_t>
+      Head;
+  auto Later = [](const Head &A, const Head &B) {
+    const std::string &FileA = *std::get<0>(A), &FileB = *std::get<0>(B);
+    return std::tie(FileA, std::get<1>(A), std::get<2>(A), std::get<3>(A),
+                    std::get<4>(A)) > std::tie(FileB, std::get<1>(B),
+                                               std::get<2>(B), std::get<3>(B),
+                                               std::get<4>(B));
+  };
+  std::priority_queue<Head, std::vector<Head>, decltype(Later)> Heads(Later);
+  auto push = [&Heads, &Reports](size_t R, size_t i) {
+    if (i < Reports[R].Diags.size()) {
+      const Diagnostic &D = Reports[R].Diags[i];
+      Heads.emplace(&D.File, D.Line, D.Column, R, i);
+    }
+  };
+  for (size_t R = 0; R < Reports.size(); ++R)
+    push(R, 0);
+
+  std::vector<Shard> Shards;
+  std::map<std::string, unsigned> NameCount;
+  std::unordered_set<std::string> Seen;
+  size_t Merged = 0, Duplicates = 0;
+  while (!Heads.empty()) {
+    size_t R = std::get<3>(Heads.top()), i = std::get<4>(Heads.top());
+    Heads.pop();
+    push(R, i + 1);
+
+    Diagnostic &D = Reports[R].Diags[i];
+    if (!Seen.insert(std::move(D.Key)).second) {
+      ++Duplicates;
+      continue;
+    }
+    if (Shards.empty() || Shards.back().Source != D.File) {
+      std::string Stem = sys::path::stem(D.File);
+      Shards.push_back(Shard());
+      Shards.back().Name =
+          Stem + "_" + std::to_string(++NameCount[Stem]) + ".json";
+      Shards.back().Source = D.File;
+    }
+    Shards.back().Diags.push_back(&D);
+    Shards.back().Origins.push_back(&Reports[R]);
+    ++Merged;
+  }
+
+  bool Written = true;
+  {
+    ThreadPool Pool(Jobs ? Jobs : llvm::hardware_concurrency());
+    std::vector<char> Ok(Shards.size(), 0);
+    for (size_t i = 0; i < Shards.size(); ++i)
+      Pool.async([&Shards, &Ok, &ClangVersion, i]() {
+        Ok[i] = writeShard(Shards[i], ClangVersion);
+      });
+    Pool.wait();
+    Written = std::all_of(Ok.begin(), Ok.end(), [](char c) { return c; });
+  }
+
+  json Index = {{"clang_version", ClangVersion},
+                {"reports", Paths.size()},
+                {"diagnostics", Merged},
+                {"duplicates", Duplicates},
+                {"stats", Stats},
+                {"shards", json::array()}};
+  for (auto &S : Shards) {
+    json Origins = json::array();
+    for (auto *R : S.Origins)
+      Origins.push_back(R->Origin);
+    Index["shards"].push_back(
+        {{"file", S.Name}, {"source", S.Source}, {"reports", Origins}});
+  }
+  SmallString<256> IndexPath(ReportDir);
+  sys::path::append(IndexPath, IndexName);
+  std::error_code EC;
+  raw_fd_ostream OS(IndexPath, EC, sys::fs::F_None);
+  if (EC) {
+    errs() << "misra-merge: " << IndexPath << ": " << EC.message() << "\n";
+    return 1;
+  }
+  OS << Index.dump(4) << "\n";
+
+  // the reports are only removed once everything made it to disk
+  if (!Written)
+    return 1;
+  if (!KeepReports) {
+    // a shard goes away only when all of its lines were merged
+    std::set<std::string> Failed;
+    for (auto &R : Reports)
+      if (R.Failed)
+        Failed.insert(R.Path);
+    for (auto &R : Reports)
+      if (!Failed.count(R.Path))
+        sys::fs::remove(R.Path);
+    sys::fs::remove(ShardDir);
+  }
+
+  outs() << "misra-merge: " << Paths.size() << " reports, " << Merged
+         << " diagnostics in " << Shards.size() << " files, " << Duplicates
+         << " duplicates\n";
+  return 0;
+}
@@ -3,7 +3,7 @@ import os
 import pickle
 import pprint
 import re
-import shutil
+import struct
 import subprocess
 
 from collections import deque
@@ -208,11 +208,22 @@ class ResourceVertex:
         self.indexfile_resources = []
         self.indexfile_targets = []
         self.indexfile_path = ""
+        # linked targets the indexfile_targets belong to, in the same order
+        self.targets = []
+        # set on the sources the CTU checkers have to run on
+        self.ctu_indexfile = None
+        self.ctu_targets = []
+        # set on the sources a CTU run imports from
+        self.emit_ast = False
 
     @property
     def indexfilename(self):
         return self.path + '.index'
 
+    @property
+    def externfilename(self):
+        return self.path + '.extern'
+
     def __repr__(self):
         return "%s %s" % (self.path, self.indexfile_targets)
         # return "%s %s" % (self.path, [v.path for v in self.parents])
@@ -243,9 +254,9 @@ class ResourceVertexManager:
             self.file_vertex_mapping[path] = vertex
         return vertex
 
-    def getVertexByAbsPath(self, path):
+    def getVertexByAbsPath(self, path, auto_add_vertex=True):
         rel_path = os.path.relpath(path, start=self.project_root)
-        return self.getVertexByRelPath(rel_path)
+        return self.getVertexByRelPath(rel_path, auto_add_vertex)
 
     def getVertices(self):
         return list(self.file_vertex_mapping.values())
@@ -406,12 +417,118 @@ class CmdAnalyzer:
         return ResourceGraph(vertex_manager)
 
 
+# Binary CTU index of the plugin, see include/CTUIndex.hpp. misra-index-merge
+# merges indexes, these are used when it is missing.
+CTU_INDEX_MAGIC = b'MISRAIDX'
+CTU_INDEX_VERSION = 1
+CTU_INDEX_HEADER = struct.Struct('<8s6I')
+CTU_INDEX_ENTRY = struct.Struct('<Q4I')
+
+
+def hashUSR(usr):
+    # FNV-1a
+    ret = 0xcbf29ce484222325
+    for c in usr:
+        ret = ((ret ^ c) * 0x100000001b3) & 0xffffffffffffffff
+    return ret
+
+
+def readIndexEntries(path):
+    with open(path, 'rb') as fp:
+        data = fp.read()
+    if not data.startswith(CTU_INDEX_MAGIC):
+        # the former text index, "<USR> <AST path>" per line
+        for line in data.splitlines():
+            usr, ast_file = line.rstrip(b'\r').split(b' ', 1)
+            yield usr, ast_file
+        return
+
+    _, version, num_files, num_buckets, num_entries, _, _ = \
+        CTU_INDEX_HEADER.unpack_from(data)
+    if version != CTU_INDEX_VERSION:
+        raise ValueError("%s: index version %d" % (path, version))
+    files_offset = CTU_INDEX_HEADER.size
+    entries_offset = files_offset + num_files * 8 + (num_buckets + 1) * 4
+    strings_offset = entries_offset + num_entries * CTU_INDEX_ENTRY.size
+
+    def string(offset, length):
+        begin = strings_offset + offset
+        return data[begin:begin + length]
+
+    files = [string(*struct.unpack_from('<2I', data, files_offset + i * 8))
+             for i in range(num_files)]
+    for i in range(num_entries):
+        _, offset, length, file_id, _ = CTU_INDEX_ENTRY.unpack_from(
+            data, entries_offset + i * CTU_INDEX_ENTRY.size)
+        yield string(offset, length), files[file_id]
+
+
+def mergeIndexFiles(destination, sources):
+    # the first definition of a USR wins
+    files = OrderedDict()
+    entries = OrderedDict()
+    for source in sources:
+        for usr, ast_file in readIndexEntries(source):
+            if usr not in entries:
+                entries[usr] = files.setdefault(ast_file, len(files))
+
+    num_buckets = 1
+    while num_buckets < len(entries):
+        num_buckets <<= 1
+    buckets = [[] for _ in range(num_buckets)]
+    for usr, file_id in entries.items():
+        hash_val = hashUSR(usr)
+        buckets[hash_val & (num_buckets - 1)].append((hash_val, usr, file_id))
+
+    strings = bytearray()
+    file_table = bytearray()
+    for ast_file in files:
+        file_table += struct.pack('<2I', len(strings), len(ast_file))
+        strings += ast_file
+    usr_offsets = {}
+    for usr in entries:
+        usr_offsets[usr] = len(strings)
+        strings += usr
+
+    bucket_table = bytearray()
+    entry_table = bytearray()
+    first = 0
+    for bucket in buckets:
+        bucket_table += struct.pack('<I', first)
+        first += len(bucket)
+        for hash_val, usr, file_id in bucket:
+            entry_table += CTU_INDEX_ENTRY.pack(hash_val, usr_offsets[usr],
+                                                len(usr), file_id, 0)
+    bucket_table += struct.pack('<I', first)
+
+    with open(destination, 'wb') as fp:
+        fp.write(CTU_INDEX_HEADER.pack(CTU_INDEX_MAGIC, CTU_INDEX_VERSION,
+                                       len(files), num_buckets, len(entries),
+                                       len(strings), 0))
+        fp.write(file_table)
+        fp.write(bucket_table)
+        fp.write(entry_table)
+        fp.write(strings)
+
+
 class VirtualLinker:
 
-    def __init__(self, project_root, report_dir):
+    def __init__(self, project_root, report_dir, merge_tool=None):
         self.project_root = project_root
         self.report_dir = report_dir
         self.ast_dir = os.path.join(self.report_dir, 'ast')
+        self.merge_tool = merge_tool
+        self.union_indexfiles = {}
+        self.index_entries = {}
+
+    def mergeIndexfiles(self, destination, sources):
+        # a USR defined by several inputs is kept once
+        if self.merge_tool:
+            subprocess.run([self.merge_tool, '-o', destination] + sources,
+                           stdout=subprocess.DEVNULL,
+                           check=True)
+        else:
+            mergeIndexFiles(destination, sources)
 
     def updateIndexfileOnResourceVertex(self, vertex):
         # already merged
@@ -437,13 +554,7 @@ class VirtualLinker:
         # print(">>> generating %s based on" % os.path.relpath(destination, start=self.ast_dir))
         # pprint.pprint([os.path.relpath(p, start=self.ast_dir) for p in vertex.indexfile_resources])
         # print("===")
-        with open(destination, 'wb') as dest_fd:
-            for f in vertex.indexfile_resources:
-                try:
-                    with open(f, 'rb') as src_fd:
-                        shutil.copyfileobj(src_fd, dest_fd)
-                except:
-                    raise
+        self.mergeIndexfiles(destination, vertex.indexfile_resources)
 
         vertex.indexfile_path = destination
         return vertex
@@ -456,13 +567,82 @@ class VirtualLinker:
                 continue
             if os.path.exists(v.indexfile_path):
                 v.indexfile_targets.append(v.indexfile_path)
+                v.targets.append(v.path)
 
         for v in vertices:
             for p in v.parents:
                 p.indexfile_targets.extend(v.indexfile_targets)
+                p.targets.extend(v.targets)
 
         return resource_graph
 
+    def getUnionIndexfile(self, indexfiles):
+        # sources linked into the same targets share one union index
+        key = tuple(indexfiles)
+        if len(key) == 1:
+            return key[0]
+        if key not in self.union_indexfiles:
+            destination = os.path.join(
+                self.ast_dir, 'union-%d.index' % len(self.union_indexfiles))
+            self.mergeIndexfiles(destination, list(key))
+            self.union_indexfiles[key] = destination
+        return self.union_indexfiles[key]
+
+    def getIndexEntries(self, indexfile):
+        if indexfile not in self.index_entries:
+            self.index_entries[indexfile] = dict(readIndexEntries(indexfile))
+        return self.index_entries[indexfile]
+
+    def scheduleCrossTUAnalysis(self, resource_graph):
+        # A source runs the CTU checkers once against the union index of the
+        # targets it is linked into, and only when one of the functions it
+        # calls without defining is defined by another TU of those targets.
+        # The plugin writes the .extern file only when CTU checkers are
+        # enabled. The sources defining those functions get emit_ast, the
+        # first pass writes no .ast. The index of a source names the .ast it
+        # writes, in the AST store it is not derived from the path.
+        scheduled = 0
+        imported_asts = set()
+        for v in resource_graph.getVertices():
+            v.ctu_indexfile = None
+            v.ctu_targets = []
+            if v.parents or not v.indexfile_targets:
+                continue
+            extern_path = os.path.join(self.ast_dir, v.externfilename)
+            if not os.path.exists(extern_path):
+                continue
+            with open(extern_path, 'rb') as fp:
+                externs = set(fp.read().splitlines())
+            if not externs:
+                continue
+
+            indexfiles = []
+            for indexfile, target in zip(v.indexfile_targets, v.targets):
+                if indexfile not in indexfiles:
+                    indexfiles.append(indexfile)
+                    v.ctu_targets.append(target)
+            indexfile = self.getUnionIndexfile(indexfiles)
+            entries = self.getIndexEntries(indexfile)
+            asts = set(entries[usr] for usr in externs if usr in entries)
+            if not asts:
+                v.ctu_targets = []
+                continue
+            v.ctu_indexfile = indexfile
+            imported_asts.update(os.path.normpath(os.fsdecode(ast_file))
+                                 for ast_file in asts)
+            scheduled += 1
+
+        for v in resource_graph.getVertices():
+            v.emit_ast = False
+            indexfile = os.path.join(self.ast_dir, v.indexfilename)
+            if v.parents or not os.path.exists(indexfile):
+                continue
+            own_asts = set(self.getIndexEntries(indexfile).values())
+            v.emit_ast = any(os.path.normpath(os.fsdecode(ast_file))
+                             in imported_asts for ast_file in own_asts)
+
+        return scheduled
+
     def updateIndexfilesOnResourceGraph(self, resource_graph):
         vertices = resource_graph.getTopologicalSortedVertices()
 
@@ -17,7 +17,6 @@ from libmisrascan import getClangCC1Args
 from libmisrascan import runCommandAndGetOutput
 from cmdanalyzer import ResourceGraph
 from cmdfilters import CCCmdFilter
-from reportutils import JSONReportHelper
 
 
 class FakeCompilerBase(ABC):
@@ -214,7 +213,8 @@ class FakeCompilerBase(ABC):
         self.preprocess(parameters)
 
         ctumode = parameters.get('ctumode')
-        if ctumode:
+        astonly = parameters.get('astmode') == 'only'
+        if ctumode or astonly:
             resource_graph = ResourceGraph.load(parameters.get('resource_graph_path'))
 
         # scan each source file in the command
@@ -227,19 +227,29 @@ class FakeCompilerBase(ABC):
             lang_args = ['-x', lang]
             parameters.update({'lang': lang})
 
+            # only the ASTs the CTU runs import from are written
+            if astonly:
+                vertex = resource_graph.vertex_manager.getVertexByAbsPath(os.path.abspath(src))
+                if not vertex.emit_ast:
+                    continue
+
+            # one CTU run against the union index of the targets, if
+            # misra-scan scheduled the source at all
             if ctumode:
                 vertex = resource_graph.vertex_manager.getVertexByAbsPath(os.path.abspath(src))
-                indexfiles = vertex.indexfile_targets
+                if not vertex.ctu_indexfile:
+                    continue
+                indexfile = vertex.ctu_indexfile
+                parameters.update({'targets': vertex.ctu_targets})
             else:
-                indexfiles = [None]
+                indexfile = None
 
-            for indexfile in indexfiles:
-                self.registerCustomizedParameters(parameters,
-                                                  src,
-                                                  indexfile=indexfile,
-                                                  lang_args=lang_args,
-                                                  c_args=arginfo.options)
-                self.invokeAnalyzer(parameters)
+            self.registerCustomizedParameters(parameters,
+                                              src,
+                                              indexfile=indexfile,
+                                              lang_args=lang_args,
+                                              c_args=arginfo.options)
+            self.invokeAnalyzer(parameters)
 
 
 class StaticAnalyzerFakeCompiler(FakeCompilerBase):
@@ -293,6 +303,12 @@ class MisraFakeCompiler(FakeCompilerBase):
     def retriveCustomizedParametersFromScanBuild(self, param):
         param.update({
             'ctumode': os.getenv('CCC_ANALYZER_CTUMODE'),
+            'astmode': os.getenv('CCC_ANALYZER_ASTMODE'),
+            'ast_store': os.getenv('CCC_ANALYZER_AST_STORE'),
+            'compress_ast': os.getenv('CCC_ANALYZER_COMPRESS_AST'),
+            'report_format': os.getenv('CCC_ANALYZER_REPORT_FORMAT') or 'json',
+            'claim_dir': os.getenv('CCC_ANALYZER_CLAIM_DIR'),
+            'shard_dir': os.getenv('CCC_ANALYZER_SHARD_DIR'),
             'resource_graph_path': os.getenv('CCC_ANALYZER_RESOURCE_GRAPH_PATH')
         })
         return param
@@ -305,11 +321,11 @@ class MisraFakeCompiler(FakeCompilerBase):
                                      lang_args=[],
                                      c_args=[]):
 
-        def getReportOutputPath(output_dir, src):
+        def getReportOutputPath(output_dir, src, report_format):
             prefix, _ = os.path.splitext(os.path.basename(src))
             time_format = '%Y-%m-%d-%H%M%S-%f'
             time_stamp = datetime.datetime.now().strftime(time_format)
-            suffix = '_%s.json' % time_stamp
+            suffix = '_%s.%s' % (time_stamp, report_format)
             return os.path.join(output_dir, prefix + suffix)
 
         def getAstOutputDir(output_dir, project_root, src):
@@ -328,16 +344,49 @@ class MisraFakeCompiler(FakeCompilerBase):
         o_dir = param['output_dir']
         proj_root = param['project_root']
         a_args = param['analyzer_args']
+        report_format = param['report_format']
+        claim_dir = param['claim_dir']
+        shard_dir = param['shard_dir']
+        astmode = param['astmode']
+        ast_store = param['ast_store']
 
         # param['analyzer_args'] does not contain output flags for JSON report
         # and .ast files, so we are going to fill in the flags.
         # Notice that we have to reserve param['analyzer_args'] because the
         # output flags are inconvenient for users to invoke the analyzer
         # command again.
-        report_path = getReportOutputPath(o_dir, src)
+        report_path = getReportOutputPath(o_dir, src, report_format)
         ast_dir = getAstOutputDir(o_dir, proj_root, src)
         o_args = ['-plugin-arg-Misra-Checker', '-o=%s' % report_path]
+        # the report has every diagnostic, nobody reads them on stderr
+        o_args.extend(['-plugin-arg-Misra-Checker', '-quiet=true'])
+        if report_format != 'json':
+            o_args.extend(['-plugin-arg-Misra-Checker',
+                           '-format=%s' % report_format])
         ast_args = ['-plugin-arg-Misra-Checker', '-astdir=%s' % ast_dir]
+        if claim_dir:
+            # violations in a header are reported by one TU only
+            o_args.extend(['-plugin-arg-Misra-Checker',
+                           '-claim-dir=%s' % claim_dir])
+        if shard_dir:
+            # diagnostics are appended to the shard of the file they are in
+            o_args.extend(['-plugin-arg-Misra-Checker',
+                           '-shard-dir=%s' % shard_dir])
+        if proj_root:
+            # decls outside the project are not checked
+            o_args.extend(['-plugin-arg-Misra-Checker',
+                           '-project-root=%s' % proj_root])
+        if astmode:
+            # 'false' while checking, 'only' when misra-scan asks for the .ast
+            ast_args.extend(['-plugin-arg-Misra-Checker',
+                             '-emit-ast=%s' % astmode])
+        if ast_store:
+            # the .ast are named by source and options, not by path
+            ast_args.extend(['-plugin-arg-Misra-Checker',
+                             '-ast-store=%s' % ast_store])
+            if param['compress_ast']:
+                ast_args.extend(['-plugin-arg-Misra-Checker',
+                                 '-compress-ast=true'])
         if ctumode:
             ast_args.extend(['-plugin-arg-Misra-Checker', '-ctu=true'])
             ast_args.extend(['-plugin-arg-Misra-Checker', '-index=%s' % indexfile])
@@ -385,6 +434,8 @@ class MisraFakeCompiler(FakeCompilerBase):
                 'cwd': os.getcwd(),
                 'cmd': param['analyzer_cmd'],
                 'report_path': param['report_path'],
+                # the targets the diagnostics of a CTU run belong to
+                'targets': param.get('targets', []),
             }, fp)
 
     def preprocess(self, param):
@@ -392,6 +443,6 @@ class MisraFakeCompiler(FakeCompilerBase):
 
     def postprocess(self, param):
         report_path = param['report_path']
+        # the plugin writes real paths, the report is left as it is
         if os.path.exists(report_path):
-            JSONReportHelper.rewriteWithAbsPath(report_path)
             self.log(param)
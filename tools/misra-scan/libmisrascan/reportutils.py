@@ -12,12 +12,14 @@ from collections import deque
 from collections import namedtuple
 from collections import OrderedDict
 from operator import attrgetter
+from itertools import chain
 from itertools import compress
 
 from jinja2 import Environment, FileSystemLoader, Template, select_autoescape
 from libmisrascan import LIBMISRASCAN_TEMPLATES
 from libmisrascan import listof
 from libmisrascan import MisraNamedTuple
+from libmisrascan import runCommandAndGetOutput
 
 
 JINJA2_ENV = Environment(
@@ -36,6 +38,48 @@ RESOURCE_GRAPH_TEMPLATE = JINJA2_ENV.get_template('resource_graph.html')
 CODE_VIEWER_TEMPLATE = JINJA2_ENV.get_template('code_viewer.html')
 
 
+# report formats the plugin writes with -format=, keyed by file extension
+REPORT_FORMATS = OrderedDict([
+    ('.json', 'json'),
+    ('.cbor', 'cbor'),
+    ('.msgpack', 'msgpack'),
+])
+
+
+def loadReport(report_path):
+    _, ext = os.path.splitext(report_path)
+    report_format = REPORT_FORMATS.get(ext, 'json')
+    if report_format == 'cbor':
+        import cbor2
+        with open(report_path, 'rb') as fp:
+            return cbor2.load(fp)
+    if report_format == 'msgpack':
+        import msgpack
+        with open(report_path, 'rb') as fp:
+            return msgpack.unpack(fp, raw=False)
+    with open(report_path) as fp:
+        return json.load(fp)
+
+
+def reportLocations(content):
+    for diag in content.get('diagnostics') or []:
+        for path in diag.get('path', []):
+            location = path.get('location')
+            if location is not None:
+                yield location
+            for location in path.get('ranges', []):
+                yield location
+
+
+def expandFileTable(content):
+    # locations refer to files by their index in the "files" table
+    files = content.get('files') or []
+    for location in reportLocations(content):
+        file = location.get('file')
+        if isinstance(file, int) and 0 <= file < len(files):
+            location.update({'file': files[file]})
+
+
 def computeSHA256Digest(file_path):
     with open(file_path, 'rb') as fp:
         contents = fp.read()
@@ -113,7 +157,9 @@ PathDiagnostic = MisraNamedTuple(
 MisraCmdLog = MisraNamedTuple(
     'MisraCmdLog',
     field_names=['cwd',
-                 'cmd'])
+                 'cmd',
+                 'targets'],
+    default_val={'targets': []})
 
 
 MisraAnalyzerFailure = MisraNamedTuple(
@@ -196,12 +242,15 @@ class ReportHelper(ABC):
     def isEmptyReport(self, content):
         pass
 
-    def scanReports(self):
+    def reportFiles(self):
         path_pattern = os.path.join(self.report_dir, self.filename_pattern)
+        return glob.glob(path_pattern)
+
+    def scanReports(self):
         reports = []
         hash_have_seen = {}
 
-        for file_path in glob.glob(path_pattern):
+        for file_path in self.reportFiles():
             content = self.readReport(file_path)
 
             # remove empty reports
@@ -244,10 +293,14 @@ class JSONReportHelper(ReportHelper):
     def __init__(self,
                  src_dir=None,
                  report_dir=None,
-                 filename_pattern='*_*.json'):
+                 filename_pattern='*_*.json',
+                 merge_tool=None):
         super().__init__(report_dir, filename_pattern)
         self.src_dir = src_dir
+        self.merge_tool = merge_tool
         self.code_highlighter = SourceCodeHighlighter()
+        self.stats = {}
+        self._stats_seen = set()
 
     @property
     def logs(self):
@@ -265,15 +318,85 @@ class JSONReportHelper(ReportHelper):
             content = json.load(fp)
         return content
 
+    def reportFiles(self):
+        # the plugin writes one of REPORT_FORMATS, look for each extension
+        pattern, _ = os.path.splitext(self.filename_pattern)
+        ret = []
+        for ext in REPORT_FORMATS:
+            path_pattern = os.path.join(self.report_dir, pattern + ext)
+            ret.extend(glob.glob(path_pattern))
+        return ret
+
     def readReport(self, report_path):
-        with open(report_path) as fp:
-            content = json.load(fp)
+        content = loadReport(report_path)
+        expandFileTable(content)
         content.update({'report_path': report_path})
+        self.addStats(report_path, content.get('stats'))
         return content
 
     def isEmptyReport(self, content):
         return not content.get('diagnostics')
 
+    def scanShards(self):
+        # the plugin appends one report per line to the shard of each file,
+        # the stats stay in the report of the TU
+        shard_dir = os.path.join(self.report_dir, 'shards')
+        for shard_path in sorted(glob.glob(os.path.join(shard_dir,
+                                                        '*_*.jsonl'))):
+            with open(shard_path) as fp:
+                for line in fp:
+                    if not line.strip():
+                        continue
+                    content = json.loads(line)
+                    expandFileTable(content)
+                    content.update({'report_path': content.get('report')})
+                    yield content
+            os.remove(shard_path)
+        if os.path.isdir(shard_dir) and not os.listdir(shard_dir):
+            os.rmdir(shard_dir)
+
+    def addStats(self, report_path, stats):
+        # reports without diagnostics are removed after reading, sum up their
+        # stats here so every translation unit counts
+        if not stats or report_path in self._stats_seen:
+            return
+        self._stats_seen.add(report_path)
+        for name, stat in stats.items():
+            total = self.stats.setdefault(name, {
+                'wall_time': 0.0,
+                'nodes': 0,
+                'diagnostics': 0,
+                'translation_units': 0
+            })
+            total['wall_time'] += stat.get('wall_time', 0.0)
+            total['nodes'] += stat.get('nodes', 0)
+            total['diagnostics'] += stat.get('diagnostics', 0)
+            total['translation_units'] += 1
+
+    def emitStats(self, filename='stats.json', top=10):
+        if not self.stats:
+            return
+
+        output_path = os.path.join(self.report_dir, filename)
+        with open(output_path, 'w') as fp:
+            json.dump(self.stats, fp, indent=4, sort_keys=True)
+
+        print("[misra-scan] slowest checkers and phases:")
+        ranking = sorted(self.stats.items(),
+                         key=lambda item: item[1]['wall_time'],
+                         reverse=True)
+        for name, stat in ranking[:top]:
+            print("  %-40s %10.3fs %12d nodes %8d diagnostics" %
+                  (name, stat['wall_time'], stat['nodes'],
+                   stat['diagnostics']))
+        print(output_path)
+
+    def process(self, args, env):
+        # collecting the bug reports also sums up their stats
+        self.bug_report_entries
+        self.emitStats()
+        super().process(args, env)
+
     def getLogs(self):
         ret = {}
         path_pattern = os.path.join(self.report_dir, 'logs', 'cmd_*.log.json')
@@ -294,12 +417,35 @@ class JSONReportHelper(ReportHelper):
         return ret
 
     def getBugReportEntries(self):
+        if self.merge_tool:
+            diagnostics, report_refs = self.mergeReportsWithTool()
+        else:
+            diagnostics, report_refs = self.mergeReports()
+
+        # generate html report for each defect
+        ret = []
+        for diag in diagnostics:
+            src_relpath = os.path.relpath(diag.location.file, start=self.src_dir)
+            prev_report_link = report_refs.get(hash(diag))
+            report_link = self.genSingleDefectHTML(diag, prev_report_link)
+            ret.append(BugReportEntry(diag.category,
+                                      diag.type,
+                                      diag.description,
+                                      src_relpath,
+                                      'unknown',
+                                      diag.location.line,
+                                      len(diag.path),
+                                      report_link))
+        ret.sort(key=attrgetter('bug_type'))
+        return ret
+
+    def mergeReports(self):
         from reportfilters import ReportFilterManager
 
         diagnostics = []
         report_refs = {}
         hash_have_seen = {}
-        for report in self.scanReports():
+        for report in chain(self.scanReports(), self.scanShards()):
             report_path = report.get('report_path')
             for diag in report.get('diagnostics'):
 
@@ -320,10 +466,11 @@ class JSONReportHelper(ReportHelper):
                     diagnostics.append(pd)
                     report_refs[hash_val] = report_path
             # remove original report files
-            os.remove(report_path)
+            if os.path.exists(report_path):
+                os.remove(report_path)
 
         if not diagnostics:
-            return []
+            return [], report_refs
 
         # customized filter
         filter_manager = ReportFilterManager()
@@ -352,50 +499,56 @@ class JSONReportHelper(ReportHelper):
             clang_version=report.get('clang_version'),
             diagnostics=[])
         self.emitMergedReports(report_template, diagnostics)
+        return diagnostics, report_refs
 
-        # generate html report for each defect
-        ret = []
-        for diag in diagnostics:
-            src_relpath = os.path.relpath(diag.location.file, start=self.src_dir)
-            prev_report_link = report_refs.get(hash(diag))
-            report_link = self.genSingleDefectHTML(diag, prev_report_link)
-            ret.append(BugReportEntry(diag.category,
-                                      diag.type,
-                                      diag.description,
-                                      src_relpath,
-                                      'unknown',
-                                      diag.location.line,
-                                      len(diag.path),
-                                      report_link))
-        ret.sort(key=attrgetter('bug_type'))
-        return ret
+    def mergeReportsWithTool(self):
+        # misra-merge does what mergeReports does but the customized filters,
+        # it leaves the merged reports and an index of them behind
+        from reportfilters import ReportFilterManager
 
-    @staticmethod
-    def rewriteWithAbsPath(report_path):
+        cmd = [self.merge_tool, self.report_dir]
+        if self.src_dir:
+            cmd.append('-src-dir=%s' % self.src_dir)
+        for line in runCommandAndGetOutput(cmd):
+            print(line)
 
-        def rewriteLocation(location):
-            file = location.get('file')
-            # do not rewrite path if it is null
-            if file:
-                location.update({'file': os.path.realpath(file)})
+        index_path = os.path.join(self.report_dir, 'merged-index.json')
+        with open(index_path) as fp:
+            index = json.load(fp)
+        os.remove(index_path)
+        self.stats = index.get('stats', {})
 
-        with open(report_path) as fp:
-            content = json.load(fp)
+        diagnostics = []
+        report_refs = {}
+        shard_paths = []
+        for shard in index.get('shards', []):
+            shard_path = os.path.join(self.report_dir, shard['file'])
+            shard_paths.append(shard_path)
+            with open(shard_path) as fp:
+                content = json.load(fp)
+            for diag, report_path in zip(content['diagnostics'],
+                                         shard['reports']):
+                pd = PathDiagnostic(**diag)
+                diagnostics.append(pd)
+                report_refs[hash(pd)] = report_path
 
-        diagnostics = content.get('diagnostics')
-        if diagnostics is None:
-            return
+        # customized filter, the merged reports are written again when it
+        # drops any diagnostic
+        count = len(diagnostics)
+        filter_manager = ReportFilterManager()
+        for filter_obj in filter_manager.filters():
+            mask = filter_obj.generateFilterMask(diagnostics)
+            diagnostics = list(compress(diagnostics, mask))
 
-        for diag in diagnostics:
-            for path in diag.get('path', []):
-                location = path.get('location')
-                rewriteLocation(location)
-                ranges = path.get('ranges', [])
-                for location in ranges:
-                    rewriteLocation(location)
+        if len(diagnostics) != count:
+            for shard_path in shard_paths:
+                os.remove(shard_path)
+            report_template = MisraBugReport(
+                clang_version=index.get('clang_version'),
+                diagnostics=[])
+            self.emitMergedReports(report_template, diagnostics)
 
-        with open(report_path, 'w') as fp:
-            fp.write(json.dumps(content))
+        return diagnostics, report_refs
 
     def emitMergedReports(self, report_template, diagnostics):
 
@@ -439,6 +592,10 @@ class JSONReportHelper(ReportHelper):
             if not log:
                 return ''
 
+            if log.targets:
+                # a CTU run covers every target the source is linked into
+                return '# targets: %s\ncd %s\n%s' % (', '.join(log.targets),
+                                                      log.cwd, log.cmd)
             return 'cd %s\n%s' % (log.cwd, log.cmd)
 
         def getHtmlPath(output_dir, basename):
@@ -5,11 +5,13 @@ import getpass
 import multiprocessing
 import os
 import re
+import shutil
 import socket
 import subprocess
 import tempfile
 from abc import ABC
 from abc import abstractmethod
+from operator import attrgetter
 
 from libmisrascan import LIBMISRASCAN_BIN
 from libmisrascan import exists
@@ -466,6 +468,31 @@ class MisraScanBuild(ScanBuildBase):
             metavar='<config path>',
             dest='config_path',
             help="""Loading config file of external checkers.""")
+        checker_opts.add_argument(
+            '--report-format',
+            '-report-format',
+            dest='report_format',
+            default='json',
+            choices=['json', 'cbor', 'msgpack'],
+            help="""Format of the per translation unit reports. cbor and
+            msgpack are smaller and faster to write and read, they need the
+            cbor2 or msgpack python package.""")
+        checker_opts.add_argument(
+            '--compress-ast',
+            '-compress-ast',
+            dest='compress_ast',
+            action='store_true',
+            help="""Store the ASTs imported by the cross translation unit
+            checkers compressed with zlib. They are inflated to a cache
+            removed after the scan.""")
+        checker_opts.add_argument(
+            '--dedup-headers',
+            '-dedup-headers',
+            dest='dedup_headers',
+            action='store_true',
+            help="""Report the violations in a header only in the first
+            translation unit which finds them, instead of once for every
+            translation unit including it.""")
 
     def checkArgumentValidity(self, args):
         if not args.plugins:
@@ -492,7 +519,16 @@ class MisraScanBuild(ScanBuildBase):
         return ' '.join(params)
 
     def setupCustomizedEnvVars(self, args, env):
-        pass
+        env['CCC_ANALYZER_REPORT_FORMAT'] = args.report_format
+        env['CCC_ANALYZER_SHARD_DIR'] = os.path.join(args.output, 'shards')
+        # the .ast needed by the CTU checkers are written once they are known
+        env['CCC_ANALYZER_ASTMODE'] = 'false'
+        env['CCC_ANALYZER_AST_STORE'] = os.path.join(args.output, 'ast',
+                                                     'store')
+        if args.compress_ast:
+            env['CCC_ANALYZER_COMPRESS_AST'] = 'yes'
+        if args.dedup_headers:
+            env['CCC_ANALYZER_CLAIM_DIR'] = os.path.join(args.output, 'claims')
 
     def replaceBuildCmd(self, args):
 
@@ -503,6 +539,23 @@ class MisraScanBuild(ScanBuildBase):
         if args.ignore_errors and isMake(cmd):
             args.build.extend(['-k', '-i'])
 
+    def selectCommands(self, cmd_records, resource_graph, scheduled):
+        # the commands compiling a source scheduled for a pass, a source
+        # compiled once per target runs once, its builds name one AST in the
+        # store
+        vertex_manager = resource_graph.vertex_manager
+        ret = []
+        sources = set()
+        for cmd_record in cmd_records:
+            inputs = cmd_record.getFullPaths(cmd_record.arginfo.inputs)
+            vertices = [vertex_manager.getVertexByAbsPath(p, False)
+                        for p in inputs]
+            paths = set(v.path for v in vertices if v and scheduled(v))
+            if paths - sources:
+                sources.update(paths)
+                ret.append(cmd_record)
+        return ret
+
     def runModifiedBuildCommand(self, args):
         env = self.setupEnvVars(args)
         self.replaceBuildCmd(args)
@@ -514,6 +567,7 @@ class MisraScanBuild(ScanBuildBase):
         time_begin = time.time()
         cmd_records = cmd_analyzer.analyze(strace_log)
         integrated_args = []
+        ctu_candidates = []
         for cmd_record in cmd_records:
             if cmd_record.isCC:
                 cmd_record.argv[0] = self.CC_ANALYZER
@@ -522,6 +576,7 @@ class MisraScanBuild(ScanBuildBase):
             else:
                 continue
             integrated_args.append((cmd_record.argv, cmd_record.pwd, env))
+            ctu_candidates.append(cmd_record)
         elapsed_time = time.time() - time_begin
         print(f" ({elapsed_time})")
 
@@ -535,23 +590,54 @@ class MisraScanBuild(ScanBuildBase):
         print("[misra-scan] running cross-translation-unit checkers...", end="")
         time_begin = time.time()
         project_root = os.getcwd()
-        vitual_linker = VirtualLinker(project_root, args.output)
+        # misra-index-merge is built next to clang, without it python merges
+        index_merge_tool = exists(os.path.join(os.path.dirname(args.clang),
+                                               'misra-index-merge')) or \
+            exists('misra-index-merge') or None
+        vitual_linker = VirtualLinker(project_root, args.output,
+                                      merge_tool=index_merge_tool)
         report_helper = JSONReportHelper(report_dir=args.output)
         resource_graph = cmd_analyzer.buildResourceGraph(project_root, cmd_records)
         resource_graph = vitual_linker.updateIndexfilesOnResourceGraph(resource_graph)
+        vitual_linker.scheduleCrossTUAnalysis(resource_graph)
         shared_obj_path = vitual_linker.save(resource_graph)
         report_helper.genResourceGraphHTML(resource_graph)
-        env.update({
-            'CCC_ANALYZER_CTUMODE': 'yes',
-            'CCC_ANALYZER_RESOURCE_GRAPH_PATH': shared_obj_path
-        })
-        with multiprocessing.Pool() as process_pool:
-            process_pool.map(runDispatchedCommand, integrated_args)
+        env['CCC_ANALYZER_RESOURCE_GRAPH_PATH'] = shared_obj_path
+
+        # only the TUs the CTU runs import from write their .ast
+        ast_records = self.selectCommands(ctu_candidates, resource_graph,
+                                          attrgetter('emit_ast'))
+        if ast_records:
+            env['CCC_ANALYZER_ASTMODE'] = 'only'
+            with multiprocessing.Pool() as process_pool:
+                process_pool.map(runDispatchedCommand,
+                                 [(r.argv, r.pwd, env) for r in ast_records])
+        del env['CCC_ANALYZER_ASTMODE']
+
+        env['CCC_ANALYZER_CTUMODE'] = 'yes'
+        if args.dedup_headers:
+            # the CTU checkers claim the headers again
+            env['CCC_ANALYZER_CLAIM_DIR'] = os.path.join(args.output,
+                                                         'claims-ctu')
+        ctu_records = self.selectCommands(ctu_candidates, resource_graph,
+                                          attrgetter('ctu_indexfile'))
+        ctu_args = [(r.argv, r.pwd, env) for r in ctu_records]
+        if ctu_args:
+            with multiprocessing.Pool() as process_pool:
+                process_pool.map(runDispatchedCommand, ctu_args)
+        # the inflated copies of compressed ASTs
+        shutil.rmtree(os.path.join(env['CCC_ANALYZER_AST_STORE'], 'cache'),
+                      ignore_errors=True)
         elapsed_time = time.time() - time_begin
-        print(f" ({elapsed_time})")
+        print(f" ({len(ast_records)} ASTs, {len(ctu_args)}/{len(integrated_args)} commands, {elapsed_time})")
 
     def postprocess(self, args, env):
         print("[misra-scan] collecting reports...")
+        # misra-merge is built next to clang, without it python merges
+        merge_tool = exists(os.path.join(os.path.dirname(args.clang),
+                                         'misra-merge')) or \
+            exists('misra-merge') or None
         report_helper = JSONReportHelper(src_dir=os.getcwd(),
-                                         report_dir=args.output)
+                                         report_dir=args.output,
+                                         merge_tool=merge_tool)
         report_helper.process(args, env)